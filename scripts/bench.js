@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (c) 2025 James Prevett
+/**
+ * Benchmarks that need the native addon, run against the build in `dist` and `lib`.
+ * Usage: node --experimental-addon-modules scripts/bench.js [benchmark...]
+ * With no arguments, every benchmark is run.
+ */
+import { spawnSync } from 'node:child_process';
+import { mkdtempSync, rmSync, writeFileSync } from 'node:fs';
+import { availableParallelism, tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { performance } from 'node:perf_hooks';
+import { clang, parse, parseMany, parseProject } from '../dist/index.js';
+import native from '../lib/xcompile-native.node';
+
+const dir = mkdtempSync(join(tmpdir(), 'xcompile-bench-'));
+
+/** Headers from libc, so each file takes a realistic amount of time to parse */
+const headers = ['stdio.h', 'stdlib.h', 'string.h', 'math.h', 'ctype.h', 'time.h', 'errno.h', 'limits.h']
+	.map(header => `#include <${header}>\n`)
+	.join('');
+
+/**
+ * Writes a C file that includes the libc headers, with some functions of its own.
+ * Unused functions are skipped, so `main` calls all of them.
+ */
+function source(name, functions = 20) {
+	const path = join(dir, name);
+	const prefix = name.replace(/\W/g, '_');
+	let text = headers,
+		calls = '';
+	for (let i = 0; i < functions; i++) {
+		text += `int ${prefix}_${i}(int a, const char *s) { return a * ${i} + (int)strlen(s); }\n`;
+		calls += `\tr += ${prefix}_${i}(r, "${i}");\n`;
+	}
+	writeFileSync(path, text + `int main(void) {\n\tint r = 0;\n${calls}\treturn r;\n}\n`);
+	return path;
+}
+
+/**
+ * Counts the nodes in an object tree from the native addon
+ */
+function countNodes(nodes) {
+	let count = 0;
+	for (const node of nodes) count += 1 + countNodes(node.inner ?? []);
+	return count;
+}
+
+async function time(fn) {
+	const start = performance.now();
+	await fn();
+	return performance.now() - start;
+}
+
+/**
+ * Runs code in a new process, so its peak memory usage can be measured on its own.
+ * The code is a module that is passed `args`, and should print its result as JSON on the last line.
+ */
+function child(code, args) {
+	const { status, stdout, stderr } = spawnSync(
+		process.execPath,
+		['--experimental-addon-modules', '--input-type=module', '-e', code, JSON.stringify(args)],
+		{ encoding: 'utf8', maxBuffer: Infinity }
+	);
+	if (status) throw new Error(stderr);
+	return JSON.parse(stdout.trimEnd().split('\n').at(-1));
+}
+
+function median(values) {
+	const sorted = values.toSorted((a, b) => a - b);
+	return sorted[sorted.length >> 1];
+}
+
+const benchmarks = {
+	/**
+	 * Throughput of parseMany against the number of threads.
+	 * The binary format is used so marshalling, which happens on the main thread, stays small.
+	 */
+	async threads() {
+		const cpus = availableParallelism();
+		const files = Array.from({ length: Math.max(16, cpus * 4) }, (_, i) => source(`threads-${i}.c`));
+
+		const counts = [1];
+		while (counts.at(-1) * 2 <= cpus) counts.push(counts.at(-1) * 2);
+		if (counts.at(-1) != cpus) counts.push(cpus);
+
+		const rows = [];
+		let single;
+		for (const concurrency of counts) {
+			const ms = await time(() => parseMany('c', files, { concurrency, binary: true }));
+			single ??= ms;
+			rows.push({
+				threads: concurrency,
+				'TUs/sec': +((files.length / ms) * 1000).toFixed(1),
+				speedup: +(single / ms).toFixed(2),
+				efficiency: +(single / ms / concurrency).toFixed(2),
+			});
+		}
+		console.table(rows);
+	},
+
+	/**
+	 * A project read from a compilation database, against parsing each of its files one after another.
+	 * Each file has its own defines, like a real project.
+	 */
+	async project() {
+		const count = Math.max(16, availableParallelism() * 2);
+		const files = Array.from({ length: count }, (_, i) => source(`project-${i}.c`));
+		const database = join(dir, 'compile_commands.json');
+		const commands = files.map((file, i) => ({
+			directory: dir,
+			file,
+			arguments: ['cc', `-DUNIT=${i}`, '-c', file, '-o', file.replace(/\.c$/, '.o')],
+		}));
+		writeFileSync(database, JSON.stringify(commands));
+
+		const rows = [];
+		for (const [mode, run] of [
+			['sequential', () => files.forEach(file => [...parse('c', file, {})])],
+			['project', () => parseProject(database, {})],
+			['project (binary)', () => parseProject(database, { binary: true })],
+		]) {
+			const ms = await time(run);
+			rows.push({ mode, ms: +ms.toFixed(1), 'TUs/sec': +((count / ms) * 1000).toFixed(1) });
+		}
+		console.table(rows);
+	},
+
+	/**
+	 * Parsing a file after small edits, from scratch against reparsing with a precompiled preamble.
+	 * The edits are passed as unsaved contents, like an editor would.
+	 */
+	async reparse() {
+		const file = source('reparse.c');
+		const edits = Array.from({ length: 10 }, (_, i) => ({
+			[file]: headers + `int edited(void) { return ${i}; }\nint main(void) { return edited(); }\n`,
+		}));
+
+		const cold = [];
+		for (const unsaved of edits) {
+			const index = new native.Index();
+			cold.push(await time(() => index.parse(file, [], { unsaved })));
+			index.dispose();
+		}
+
+		const index = new native.Index();
+		try {
+			let unit;
+			const first = await time(() => (unit = index.parse(file, [], { preamble: true })));
+			const warm = [];
+			for (const unsaved of edits) warm.push(await time(() => unit.reparse(unsaved)));
+
+			const coldMs = median(cold);
+			console.table(
+				[
+					['cold', coldMs],
+					['first (builds preamble)', first],
+					['warm reparse', median(warm)],
+				].map(([parse, ms]) => ({ parse, ms: +ms.toFixed(1), 'of cold': +(ms / coldMs).toFixed(2) }))
+			);
+		} finally {
+			index.dispose();
+		}
+	},
+
+	/**
+	 * The binary AST against the object tree, both for the transfer from the addon and for parsing into XIR.
+	 * Each is run in its own process to measure its peak RSS.
+	 */
+	async binary() {
+		const file = source('binary.c', 2000);
+
+		const nodes = countNodes(native.getClangAST(file, [], {}));
+
+		const addon = JSON.stringify(import.meta.resolve('../lib/xcompile-native.node'));
+		const index = JSON.stringify(import.meta.resolve('../dist/index.js'));
+		const code = `
+			import { performance } from 'node:perf_hooks';
+			const { file, binary, stage } = JSON.parse(process.argv[1]);
+			const { default: native } = await import(${addon});
+			const { parse } = await import(${index});
+			const start = performance.now();
+			if (stage == 'transfer') native.getClangAST(file, [], { binary });
+			else [...parse('c', file, { binary })];
+			const ms = performance.now() - start;
+			console.log(JSON.stringify({ ms, rss: process.resourceUsage().maxRSS }));
+		`;
+
+		const rows = [];
+		for (const stage of ['transfer', 'parse']) {
+			for (const binary of [false, true]) {
+				const { ms, rss } = child(code, { file, binary, stage });
+				rows.push({
+					stage,
+					format: binary ? 'binary' : 'objects',
+					ms: +ms.toFixed(1),
+					'nodes/sec': Math.round((nodes / ms) * 1000),
+					'peak RSS (MiB)': +(rss / 1024).toFixed(1),
+				});
+			}
+		}
+		console.log(`${nodes} nodes`);
+		console.table(rows);
+	},
+
+	/**
+	 * Throughput of `clang.parse` on nodes from the addon, which all have the same properties,
+	 * against copies made with JSON, which leave out undefined properties like nodes used to.
+	 */
+	async shapes() {
+		const nodes = native.getClangAST(source('shapes.c', 500), [], {});
+		const count = countNodes(nodes);
+		const inputs = { 'fixed shape': nodes, 'varied shapes': JSON.parse(JSON.stringify(nodes)) };
+
+		const times = { 'fixed shape': [], 'varied shapes': [] };
+		for (let round = 0; round < 10; round++) {
+			for (const [name, input] of Object.entries(inputs)) {
+				times[name].push(await time(() => input.forEach(node => [...clang.parse(node)])));
+			}
+		}
+
+		console.table(
+			Object.entries(times).map(([nodes, ms]) => ({
+				nodes,
+				ms: +median(ms).toFixed(1),
+				'nodes/sec': Math.round((count / median(ms)) * 1000),
+			}))
+		);
+	},
+
+	/**
+	 * The signatures of all functions in the libc headers, filtered natively against a full walk
+	 */
+	async kinds() {
+		const file = join(dir, 'kinds.c');
+		writeFileSync(file, headers);
+
+		const queries = {
+			'full walk': () => native.getClangAST(file, [], {}).filter(node => node.kind == 'FunctionDecl'),
+			'kind filter': () =>
+				native.getClangAST(file, [], { includeKinds: ['FunctionDecl'], maxDepth: { FunctionDecl: 1 } }),
+		};
+
+		const rows = [];
+		for (const [query, run] of Object.entries(queries)) {
+			let functions;
+			const times = [];
+			for (let i = 0; i < 5; i++) times.push(await time(() => (functions = run())));
+			rows.push({ query, ms: +median(times).toFixed(1), functions: functions.length });
+		}
+		console.table(rows);
+	},
+};
+
+const selected = process.argv.slice(2);
+for (const name of selected) if (!(name in benchmarks)) throw new Error('Unknown benchmark: ' + name);
+
+try {
+	for (const [name, run] of Object.entries(benchmarks)) {
+		if (selected.length && !selected.includes(name)) continue;
+		console.log(name + ':');
+		await run();
+	}
+} finally {
+	rmSync(dir, { recursive: true, force: true });
+}
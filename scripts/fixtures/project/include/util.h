@@ -0,0 +1,10 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+struct point {
+	int x, y;
+};
+
+int scale(int value, int factor);
+
+#endif
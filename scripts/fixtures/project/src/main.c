@@ -0,0 +1,12 @@
+#include "util.h"
+
+#ifdef MAIN_ONLY
+struct main_only {
+	struct point origin;
+};
+#endif
+
+int main(void) {
+	struct main_only m = {{1, 2}};
+	return scale(m.origin.x, m.origin.y);
+}
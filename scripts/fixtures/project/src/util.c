@@ -0,0 +1,13 @@
+#include "util.h"
+
+#ifdef UTIL_ONLY
+struct util_only {
+	const char *name;
+};
+
+struct util_only util_info = {UTIL_NAME};
+#endif
+
+int scale(int value, int factor) {
+	return value * factor;
+}
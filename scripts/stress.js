@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (c) 2025 James Prevett
+/**
+ * Parses and emits generated C with extremely long binary operator chains, timing each step.
+ * These used to overflow the stack in the native walk, `clang.parse`, and `ts.emit`.
+ * Usage: node --experimental-addon-modules scripts/stress.js [terms]
+ */
+import { mkdtempSync, rmSync, writeFileSync } from 'node:fs';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { performance } from 'node:perf_hooks';
+import { emit, parse } from '../dist/index.js';
+
+const terms = parseInt(process.argv[2] ?? '10000');
+
+const alternating = Array.from({ length: terms }, (_, i) => (i % 2 ? 'b' : 'a'));
+
+/** Unused functions are skipped, so the expression is in `main` */
+const main = expression => `int main(void) { int a = 1, b = 2; return ${expression}; }`;
+
+const cases = {
+	'sum chain': main(alternating.join(' + ')),
+	'mixed chain': main(alternating.join(' - ')),
+	'logical chain': main(alternating.join(' && ')),
+};
+
+const dir = mkdtempSync(join(tmpdir(), 'xcompile-stress-'));
+let failed = false;
+
+function time(label, fn) {
+	const start = performance.now();
+	const result = fn();
+	console.log(`    ${label}: ${(performance.now() - start).toFixed(1)}ms`);
+	return result;
+}
+
+try {
+	for (const [name, source] of Object.entries(cases)) {
+		const file = join(dir, name.replaceAll(' ', '-') + '.c');
+		writeFileSync(file, source);
+
+		for (const binary of [false, true]) {
+			console.log(`${name} (${terms} terms${binary ? ', binary AST' : ''}):`);
+			try {
+				const units = time('parse', () => [...parse('c', file, { binary })]);
+				if (!units.length) throw new Error('Nothing was parsed');
+				time('emit ts', () => emit('ts', units, {}));
+				time('emit xir-text', () => emit('xir-text', units, {}));
+			} catch (error) {
+				failed = true;
+				console.error(error);
+			}
+		}
+	}
+} finally {
+	rmSync(dir, { recursive: true, force: true });
+}
+
+if (failed) process.exit(1);
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (c) 2025 James Prevett
+/**
+ * Tests that need the native addon, run against the build in `dist` and `lib`.
+ * Usage: node --experimental-addon-modules --test scripts/test.js
+ */
+import assert from 'node:assert/strict';
+import { spawnSync } from 'node:child_process';
+import { existsSync, mkdtempSync, readFileSync, rmSync, writeFileSync } from 'node:fs';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { after, suite, test } from 'node:test';
+import { emit, parse, parseMany, parseProject } from '../dist/index.js';
+
+const fixtures = join(import.meta.dirname, 'fixtures');
+
+const dir = mkdtempSync(join(tmpdir(), 'xcompile-test-'));
+after(() => rmSync(dir, { recursive: true, force: true }));
+
+/**
+ * Writes sources to the temporary directory, returning their paths
+ */
+function write(files) {
+	return Object.entries(files).map(([name, contents]) => {
+		const path = join(dir, name);
+		writeFileSync(path, contents);
+		return path;
+	});
+}
+
+suite('binary AST', () => {
+	test('deeply nested input parses the same as the object tree', () => {
+		// Brackets are kept under Clang's default limit of 256 levels, so the deepest nesting is from the chains
+		const blocks = 100;
+		const body =
+			'{ '.repeat(blocks) +
+			`a = ${'('.repeat(100)}b${')'.repeat(100)};\n` +
+			`a = ${Array.from({ length: 2000 }, (_, i) => (i % 2 ? 'b' : 'a')).join(' = ')};\n` +
+			`b = ${Array.from({ length: 1000 }, () => 'a ? b').join(' : ')} : a;\n` +
+			'} '.repeat(blocks);
+		const [file] = write({ 'deep.c': `int main(void) { int a = 1, b = 2; ${body} return a + b; }\n` });
+
+		const objects = emit('xir-json', [...parse('c', file, {})], {});
+		const binary = emit('xir-json', [...parse('c', file, { binary: true })], {});
+		assert.ok(objects.length > 1000, 'main should be translated');
+		assert.equal(binary, objects);
+	});
+});
+
+suite('sessions', () => {
+	test('anonymous records shared by many files have valid, matching names', async () => {
+		const [a, b] = write({
+			'session.h': 'struct holder { struct { int y; } inner; };\n',
+			'session-a.c': '#include "session.h"\nint main(void) { struct holder h = {0}; return h.inner.y; }\n',
+			'session-b.c': '#include "session.h"\nint main(void) { struct holder h = {0}; return h.inner.y + 1; }\n',
+		});
+
+		const [unitsA, unitsB] = await parseMany('c', [a, b], { dedupe: true });
+		const output = emit('ts', [...unitsA, ...unitsB], {});
+
+		assert.doesNotMatch(output, /c:|@/, 'USRs should not be emitted');
+
+		// The header is only translated for the first file, so the second only refers to its declarations
+		const defined = new Set([...output.matchAll(/const (_\w+) = (?:struct|union)\(/g)].map(match => match[1]));
+		const used = new Set([...output.matchAll(/\b_usr\w+/g)].map(match => match[0]));
+		assert.ok(used.size > 0, 'the anonymous record should be named');
+		for (const name of used) assert.ok(defined.has(name), `${name} is used but never defined`);
+	});
+});
+
+suite('projects', () => {
+	const database = join(fixtures, 'project/compile_commands.json');
+
+	test('each entry is parsed with its own arguments, from `arguments` or `command`', async () => {
+		const project = await parseProject(database, {});
+
+		assert.deepEqual(
+			project.map(({ file }) => file),
+			['src/main.c', 'src/util.c'].map(file => join(fixtures, 'project', file))
+		);
+
+		const [main, util] = project.map(({ units }) => emit('ts', units, {}));
+		assert.match(main, /\bmain_only\b/);
+		assert.doesNotMatch(main, /\butil_only\b/);
+		assert.match(util, /\butil_only\b/);
+		assert.doesNotMatch(util, /\bmain_only\b/);
+
+		// The include directory is relative to the entry's directory
+		for (const output of [main, util]) assert.match(output, /\bpoint\b/);
+	});
+
+	test('--output-dir writes one file per entry, laid out like the sources', () => {
+		const outDir = join(dir, 'project-out');
+		const cli = join(import.meta.dirname, '../dist/cli.js');
+		const { status, stderr } = spawnSync(
+			process.execPath,
+			['--experimental-addon-modules', cli, 'c:ts', '-p', database, '--output-dir', outDir],
+			{ encoding: 'utf8' }
+		);
+		assert.equal(status, 0, stderr);
+
+		for (const name of ['main', 'util']) {
+			const output = join(outDir, 'src', name + '.ts');
+			assert.ok(existsSync(output), output + ' was not written');
+			assert.match(readFileSync(output, 'utf8'), new RegExp(`\\b${name}_only\\b`));
+		}
+	});
+});
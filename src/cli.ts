@@ -2,11 +2,12 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 // Copyright (c) 2025 James Prevett
 import { program } from 'commander';
-import { writeFileSync } from 'node:fs';
+import { mkdirSync, writeFileSync } from 'node:fs';
+import { dirname, join, relative } from 'node:path';
 import { parseArgs, styleText } from 'node:util';
 import $pkg from '../package.json' with { type: 'json' };
 import type { xir } from './index.js';
-import { emit, IssueLevel, onIssue, parse, stringifyIssue } from './index.js';
+import { emit, IssueLevel, IssueReporter, onIssue, parse, parseProject, setIssueLevel, watch } from './index.js';
 
 // @todo implement CLI using commander.
 program
@@ -27,8 +28,21 @@ const {
 		verbose: { short: 'v', type: 'boolean' },
 		'ignore-exit': { short: 'k', type: 'boolean' },
 		'allow-dupe': { type: 'boolean' },
+		'issue-cap': { type: 'string' },
 		'issue-entry': { type: 'string' },
 		'emit-no-casts': { type: 'boolean' },
+		watch: { short: 'w', type: 'boolean' },
+		'main-file-only': { type: 'boolean' },
+		'skip-system-headers': { type: 'boolean' },
+		'keep-header': { type: 'string', multiple: true },
+		'exclude-header': { type: 'string', multiple: true },
+		'declarations-only': { short: 'd', type: 'boolean' },
+		'binary-ast': { type: 'boolean' },
+		'lazy-ast': { type: 'boolean' },
+		'cache-dir': { type: 'string' },
+		project: { short: 'p', type: 'boolean' },
+		'output-dir': { type: 'string' },
+		dedupe: { type: 'boolean' },
 	},
 	allowPositionals: true,
 });
@@ -40,59 +54,162 @@ if (opt.help || !input) {
 	input: Path to input file(s)
 
 Sources:
-    c, clang             C, uses Clang via native bindings
-    clang-ast            C, uses a Clang AST in JSON format
+    c, clang                   C, uses Clang via native bindings
+    clang-ast                  C, uses a Clang AST in JSON format
 
 Targets:
-    ts, typescript       TypeScript
-    xir-text             A textual representation of the XCompile IR
-    xir-json             The raw JSON of the XCompile IR
+    ts, typescript             TypeScript
+    xir-text                   A textual representation of the XCompile IR
+    xir-json                   The raw JSON of the XCompile IR
 
 Options:
-    -h, --help           Display this help message
-    -V, --version        Display version information and exit
-    -v, --verbose        Display verbose messages
-    -o, --output <path>  Write output to path
-    -k, --ignore-exit    Ignore the exit code of sub-shells
-        --allow-dupe     Report duplicate issues
-        --issue-entry    Set the entry point used when computing issue messages
-        --emit-no-casts  Type casts will not be emitted`);
+    -h, --help                 Display this help message
+    -V, --version              Display version information and exit
+    -v, --verbose              Display verbose messages
+    -o, --output <path>        Write output to path
+    -k, --ignore-exit          Ignore the exit code of sub-shells
+        --allow-dupe           Report duplicate issues
+        --issue-cap <n>        Report at most n issues with the same message, then only count them (default 100)
+        --issue-entry          Set the entry point used when computing issue messages
+        --emit-no-casts        Type casts will not be emitted
+    -w, --watch                Recompile when the input changes (C only)
+        --main-file-only       Skip declarations that are not from the input file (C only)
+        --skip-system-headers  Skip declarations from system headers (C only)
+        --keep-header <glob>   Keep declarations from matching headers, even if they would be skipped
+        --exclude-header <glob>
+                               Skip declarations from matching headers (clang-ast only)
+    -d, --declarations-only    Only translate declarations, emitting stubs for functions
+        --binary-ast           Transfer the AST from Clang in a compact binary format (C only)
+        --lazy-ast             Only compute the parts of the Clang AST that are used (C only)
+        --cache-dir <path>     Cache parsed translation units in a directory (C only)
+    -p, --project              The input is a compile_commands.json, and every file in it is translated (C only)
+        --output-dir <path>    With --project, write one output file per translation unit to a directory
+        --dedupe               With --project, only translate declarations shared by many files once`);
 	process.exit(1);
 }
 
 const [source, target, ...rest] = formats.split(':');
 
-if (rest.length) console.log('Ignoring: ' + rest.join(', '));
+const parseOptions = {
+	ignoreExit: opt['ignore-exit'],
+	issueEntry: opt['issue-entry'],
+	mainFileOnly: opt['main-file-only'],
+	skipSystemHeaders: opt['skip-system-headers'],
+	keepHeaders: opt['keep-header'],
+	excludeHeaders: opt['exclude-header'],
+	declarationsOnly: opt['declarations-only'],
+	binary: opt['binary-ast'],
+	lazy: opt['lazy-ast'],
+	cacheDir: opt['cache-dir'],
+	dedupe: opt.dedupe,
+};
 
-const reported = new Set<string>();
+if (rest.length) console.log('Ignoring: ' + rest.join(', '));
 
-onIssue(i => {
-	if (i.level == IssueLevel.Debug && !opt.verbose) return;
-	const content = stringifyIssue(i, { colors: true, trace: opt.verbose });
-	if (reported.has(content) && !opt['allow-dupe']) return;
-	reported.add(content);
-	console.error(content);
-});
+setIssueLevel(opt.verbose ? IssueLevel.Debug : IssueLevel.Note);
 
-let ir: Iterable<xir.Unit>;
-try {
-	ir = parse(source, input, { ignoreExit: opt['ignore-exit'], issueEntry: opt['issue-entry'] });
-} catch (err: any) {
-	console.error(styleText('red', err instanceof Error ? err.stack : err.toString()));
+const issueCap = opt['issue-cap'] === undefined ? 100 : Number(opt['issue-cap']);
+if (!Number.isInteger(issueCap) || issueCap < 0) {
+	console.error(styleText('red', 'Invalid issue cap: ' + opt['issue-cap']));
 	process.exit(1);
 }
 
-let content: string;
-try {
-	content = emit(target, [...ir], { noCasts: opt['emit-no-casts'] });
-} catch (err: any) {
-	console.error(styleText('red', err instanceof Error ? err.stack : err.toString()));
-	process.exit(1);
-}
+const reporter = new IssueReporter({
+	colors: true,
+	trace: opt.verbose,
+	allowDupe: opt['allow-dupe'],
+	cap: issueCap,
+});
 
-if (!opt.output) {
-	console.log('No output file specified.');
-	process.exit(0);
-}
+onIssue(i => reporter.report(i));
+process.on('exit', () => reporter.finish());
+
+const extensions: Record<string, string> = { ts: '.ts', typescript: '.ts', 'xir-text': '.xir', 'xir-json': '.json' };
+
+if (opt.project) {
+	if (source != 'c' && source != 'clang') {
+		console.error(styleText('red', 'Projects are only supported for C sources'));
+		process.exit(1);
+	}
+
+	const reportError = (err: any) =>
+		console.error(styleText('red', err instanceof Error ? err.stack : err.toString()));
 
-writeFileSync(opt.output, content);
+	let project: Awaited<ReturnType<typeof parseProject>>;
+	try {
+		project = await parseProject(input, parseOptions);
+	} catch (err) {
+		reportError(err);
+		process.exit(1);
+	}
+
+	const emitOptions = { noCasts: opt['emit-no-casts'] };
+
+	if (opt['output-dir']) {
+		const root = dirname(input);
+		for (const { file, units } of project) {
+			const output = join(opt['output-dir'], relative(root, file).replace(/\.[^./]*$/, '') + extensions[target]);
+			try {
+				mkdirSync(dirname(output), { recursive: true });
+				writeFileSync(output, emit(target, units, emitOptions));
+			} catch (err) {
+				reportError(err);
+			}
+		}
+	} else if (!opt.output) {
+		console.log('No output file specified.');
+	} else {
+		try {
+			writeFileSync(opt.output, emit(target, project.flatMap(({ units }) => units), emitOptions));
+		} catch (err) {
+			reportError(err);
+			process.exit(1);
+		}
+	}
+} else if (opt.watch) {
+	if (source != 'c' && source != 'clang') {
+		console.error(styleText('red', 'Watching is only supported for C sources'));
+		process.exit(1);
+	}
+
+	if (!opt.output) {
+		console.log('No output file specified.');
+		process.exit(1);
+	}
+
+	const output = opt.output;
+
+	const reportError = (err: any) =>
+		console.error(styleText('red', err instanceof Error ? err.stack : err.toString()));
+
+	watch(input, parseOptions, ir => {
+		try {
+			writeFileSync(output, emit(target, ir, { noCasts: opt['emit-no-casts'] }));
+		} catch (err) {
+			reportError(err);
+		}
+	}).on('error', reportError);
+} else {
+	let ir: Iterable<xir.Unit>;
+	try {
+		ir = parse(source, input, parseOptions);
+	} catch (err: any) {
+		console.error(styleText('red', err instanceof Error ? err.stack : err.toString()));
+		process.exit(1);
+	}
+
+	let content: string;
+	try {
+		content = emit(target, [...ir], { noCasts: opt['emit-no-casts'] });
+	} catch (err: any) {
+		console.error(styleText('red', err instanceof Error ? err.stack : err.toString()));
+		process.exit(1);
+	}
+
+	if (!opt.output) {
+		console.log('No output file specified.');
+		process.exit(0);
+	}
+
+	writeFileSync(opt.output, content);
+}
@@ -227,6 +227,23 @@ function listText(expr: Unit[], noParans: boolean = false): string {
 	return (noParans ? '' : '(') + expr.map(text).join(', ') + (noParans ? '' : ')');
 }
 
+/**
+ * Chains of binary expressions like `a + b + c` nest on the left, and can be very long in generated code.
+ * They are handled iteratively so they can't overflow the stack.
+ */
+function binaryChainText(u: Binary): string {
+	const chain: Binary[] = [u];
+	for (let left = u.left; left.length == 1 && left[0].kind == 'binary'; left = left[0].left) chain.push(left[0]);
+
+	let result = listText(chain.at(-1)!.left);
+	for (let i = chain.length - 1; i >= 0; i--) {
+		const { operator, right } = chain[i];
+		result = `${result} ${operator} ${listText(right)} `;
+		if (i) result = `(${result})`;
+	}
+	return result;
+}
+
 export function text(u: Unit): string {
 	switch (u.kind) {
 		case 'function':
@@ -256,8 +273,9 @@ export function text(u: Unit): string {
 		case 'unary':
 			return `${u.operator} ${listText(u.expression)}`;
 		case 'assignment':
-		case 'binary':
 			return `${listText(u.left)} ${u.operator} ${listText(u.right)} `;
+		case 'binary':
+			return binaryChainText(u);
 		case 'ternary':
 			return `${listText(u.condition)} ? ${listText(u.true)} : ${listText(u.false)}`;
 		case 'postfixed': {
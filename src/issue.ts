@@ -1,7 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 // Copyright (c) 2025 James Prevett
 
-import { openSync, readSync } from 'node:fs';
+import { readFileSync } from 'node:fs';
 import { styleText } from 'node:util';
 
 /**
@@ -26,6 +26,8 @@ export interface Issue {
 	location?: Location;
 	source?: string;
 	message?: string;
+	/** The message without the details specific to this issue, used to group similar issues */
+	template?: string;
 	level: IssueLevel;
 	stack?: string;
 	toString?(): string;
@@ -42,23 +44,52 @@ const issueTypes = ['Error', 'Warning', 'Note', 'Debug'] as const;
 
 type IssueHelperName = Lowercase<(typeof issueTypes)[number]>;
 
-export type IssueHelpers<I> = Record<IssueHelperName, (message: string, init: I) => Issue>;
+export type IssueHelpers<I> = Record<IssueHelperName, (message: string, init: I, template?: string) => Issue>;
+
+/**
+ * An issue whose location and source are only resolved when first used.
+ * Most issues are filtered out or deduplicated, so they never need either.
+ */
+class IssueRecord<I> implements Issue {
+	#resolved?: Pick<Issue, 'location' | 'source'>;
+
+	public constructor(
+		public readonly level: IssueLevel,
+		public readonly message: string,
+		public readonly template: string,
+		protected readonly init: I,
+		protected readonly parse: (input: I) => Pick<Issue, 'location' | 'source'>
+	) {}
+
+	protected resolve(): Pick<Issue, 'location' | 'source'> {
+		return (this.#resolved ??= this.parse(this.init));
+	}
+
+	public get location(): Location | undefined {
+		return this.resolve().location;
+	}
+
+	public get source(): string | undefined {
+		return this.resolve().source;
+	}
+
+	public toString(): string {
+		return stringifyIssue(this, { colors: true, trace: false });
+	}
+}
 
 export function createIssueHelpers<const I>(parse: (input: I) => Pick<Issue, 'location' | 'source'>): IssueHelpers<I> {
 	const helpers = {} as IssueHelpers<I>;
 
 	for (const key of issueTypes) {
-		helpers[key.toLowerCase() as Lowercase<typeof key>] = function __reportIssue(message: string, init: I) {
-			const issue: Issue = {
-				...parse(init),
-				message,
-				level: IssueLevel[key],
-				toString() {
-					return stringifyIssue(this, { colors: true, trace: false });
-				},
-			};
-
-			emitIssue(issue);
+		const level = IssueLevel[key];
+		helpers[key.toLowerCase() as Lowercase<typeof key>] = function __reportIssue(
+			message: string,
+			init: I,
+			template: string = message
+		) {
+			const issue = new IssueRecord(level, message, template, init, parse);
+			if (level <= maxLevel) emitIssue(issue);
 			return issue;
 		};
 	}
@@ -105,22 +136,87 @@ export function __setEntry(entry: string) {
 	__entry = entry;
 }
 
-const openFiles = new Map<string, number>();
+/**
+ * A source file, read once and kept in memory.
+ * Offsets are in bytes, since that is what issue locations use.
+ */
+interface SourceFile {
+	bytes: Uint8Array;
+	/** The offset of the start of each line, computed when first needed */
+	lineStarts?: number[];
+}
+
+/** `null` for files that can't be read, so they aren't tried again */
+const sources = new Map<string, SourceFile | null>();
+
+const decoder = new TextDecoder();
+
+/**
+ * Register the contents of a source that only exists in memory, so issues in it can show the source.
+ */
+export function registerSource(path: string, contents: string): void {
+	sources.set(path, { bytes: new TextEncoder().encode(contents) });
+}
+
+/**
+ * Drop the cached contents of a source, so they are read again the next time they are needed.
+ * This should be called when a file changes.
+ */
+export function forgetSource(path: string): void {
+	sources.delete(path);
+}
+
+function loadSource(path: string): SourceFile | undefined {
+	let source = sources.get(path);
+	if (source === undefined) {
+		try {
+			source = { bytes: readFileSync(path) };
+		} catch {
+			source = null;
+		}
+		sources.set(path, source);
+	}
+	return source ?? undefined;
+}
 
 export function getSource(path: string | undefined, offset: number): string | undefined {
 	if (!path) return undefined;
-	if (!openFiles.has(path)) {
-		const fd = openSync(path, 'r');
-		openFiles.set(path, fd);
-	}
 
-	const fd = openFiles.get(path)!;
+	const source = loadSource(path);
+	if (!source) return undefined;
+
 	// Max 80 chars, 40 before and 40 after
 	const length = offset < 40 ? 80 - offset : 80;
-	const data = new Uint8Array(length);
-	readSync(fd, data, 0, length, Math.max(0, offset - 40));
+	const start = Math.max(0, offset - 40);
+
+	return decoder.decode(source.bytes.subarray(start, start + length));
+}
+
+/**
+ * Gets the 1-based line and column of an offset in a source file
+ */
+export function getLineColumn(path: string | undefined, offset: number): { line: number; column: number } | undefined {
+	if (!path) return undefined;
+
+	const source = loadSource(path);
+	if (!source) return undefined;
+
+	if (!source.lineStarts) {
+		source.lineStarts = [0];
+		for (let i = 0; i < source.bytes.length; i++) if (source.bytes[i] == 0x0a) source.lineStarts.push(i + 1);
+	}
+
+	// The last line starting at or before the offset
+	const { lineStarts } = source;
+	let low = 0,
+		high = lineStarts.length - 1;
+	while (low < high) {
+		const mid = (low + high + 1) >> 1;
+		if (lineStarts[mid] <= offset) low = mid;
+		else high = mid - 1;
+	}
 
-	return new TextDecoder().decode(data).replaceAll('\0', '');
+	return { line: low + 1, column: offset - lineStarts[low] + 1 };
 }
 
 export function stringifyIssue(i: Issue, options: Partial<IssueFormatting>): string {
@@ -156,6 +252,16 @@ export function stringifyIssue(i: Issue, options: Partial<IssueFormatting>): str
 
 const handlers = new Set<(issue: Issue) => unknown>();
 
+let maxLevel = IssueLevel.Debug;
+
+/**
+ * Only emit issues at or above a level (e.g. `IssueLevel.Warning` emits errors and warnings).
+ * Issues below the level are still created, but are never resolved or passed to handlers.
+ */
+export function setIssueLevel(level: IssueLevel) {
+	maxLevel = level;
+}
+
 /**
  * Report an issue
  * @internal
@@ -167,3 +273,118 @@ export function emitIssue(issue: Issue) {
 export function onIssue(handler: (issue: Issue) => unknown) {
 	handlers.add(handler);
 }
+
+/**
+ * Buffers text and writes it to a stream in one chunk, once per turn of the event loop.
+ * This way reporting many issues doesn't block on a write for each one.
+ */
+export class BufferedWriter {
+	protected buffer: string[] = [];
+	protected scheduled = false;
+
+	public constructor(protected readonly stream: NodeJS.WritableStream = process.stderr) {}
+
+	public write(text: string): void {
+		this.buffer.push(text);
+		if (this.scheduled) return;
+		this.scheduled = true;
+		setImmediate(() => this.flush());
+	}
+
+	public flush(): void {
+		this.scheduled = false;
+		if (!this.buffer.length) return;
+		this.stream.write(this.buffer.join(''));
+		this.buffer = [];
+	}
+}
+
+export interface IssueReporterOptions extends Partial<IssueFormatting> {
+	/** Report issues that were already reported */
+	allowDupe?: boolean;
+
+	/** How many issues with the same message template to report. After that, they are only counted */
+	cap?: number;
+
+	/** Where formatted issues are written */
+	write?(text: string): void;
+}
+
+/**
+ * Identifies an issue for deduplication, without formatting it
+ */
+export function issueKey(i: Issue): string {
+	return `${i.level}\0${i.message}\0${i.location?.unit}:${i.location?.position}`;
+}
+
+interface IssueGroup {
+	level: IssueLevel;
+	template: string;
+	count: number;
+}
+
+/**
+ * Formats and writes issues, deduplicating them and aggregating ones with the same message template.
+ * Only issues that are written are formatted, or have their location resolved.
+ */
+export class IssueReporter {
+	/** The keys of issues that were written, so at most `cap` for each template */
+	protected readonly reported = new Set<string>();
+	protected readonly groups = new Map<string, IssueGroup>();
+	protected readonly writer?: BufferedWriter;
+
+	public constructor(protected readonly options: IssueReporterOptions = {}) {
+		if (!options.write) this.writer = new BufferedWriter();
+	}
+
+	protected write(text: string): void {
+		if (this.options.write) this.options.write(text);
+		else this.writer!.write(text);
+	}
+
+	public report(issue: Issue): void {
+		const template = issue.template ?? issue.message ?? '';
+		const groupKey = issue.level + '\0' + template;
+
+		let group = this.groups.get(groupKey);
+		if (!group) {
+			group = { level: issue.level, template, count: 0 };
+			this.groups.set(groupKey, group);
+		}
+
+		/*
+			Past the cap, issues are only counted.
+			Deduplicating them would mean resolving their locations and remembering every one,
+			so the count may include duplicates.
+		*/
+		if (group.count >= (this.options.cap ?? Infinity)) {
+			group.count++;
+			return;
+		}
+
+		if (!this.options.allowDupe) {
+			const key = issueKey(issue);
+			if (this.reported.has(key)) return;
+			this.reported.add(key);
+		}
+
+		group.count++;
+		this.write(stringifyIssue(issue, this.options) + '\n');
+	}
+
+	/**
+	 * Writes how many times each message template was reported, for templates reported past the cap,
+	 * then flushes any buffered output
+	 */
+	public finish(): void {
+		const cap = this.options.cap ?? Infinity;
+		for (const { level, template, count } of this.groups.values()) {
+			if (count <= cap) continue;
+			const name = this.options.colors
+				? styleText([colors[level], 'bold'], IssueLevel[level])
+				: IssueLevel[level];
+			this.write(`${name}: ${template} ×${count} (${count - cap} not shown)\n`);
+		}
+		this.writer?.flush();
+	}
+}
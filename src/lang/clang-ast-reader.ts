@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (c) 2025 James Prevett
+/**
+ * Incremental reading of Clang's JSON AST (`clang -Xclang -ast-dump=json`).
+ * Dumps can be larger than the maximum length of a string,
+ * so top-level declarations are read one at a time instead of parsing the whole dump at once.
+ */
+import { closeSync, createReadStream, openSync, readSync } from 'node:fs';
+import type { Node } from './clang.js';
+
+const chunkSize = 1 << 20;
+
+export interface ClangASTReaderOptions {
+	/**
+	 * Whether to skip a top-level declaration.
+	 * `file` is the file the declaration is in, and is missing for implicit declarations.
+	 * `includedFrom` is the file that included `file`, and is missing for declarations in the main file.
+	 */
+	skip?(file: string | undefined, includedFrom: string | undefined): boolean;
+}
+
+interface Frame {
+	isArray: boolean;
+	/** The object or array being built. Missing when the value is skipped */
+	value?: Record<string, unknown> | unknown[];
+	/** For objects, the key of the member being read */
+	key?: string;
+}
+
+/** The keys of objects that are locations, which may have an `includedFrom` */
+const locationKeys = new Set(['loc', 'spellingLoc', 'expansionLoc', 'begin', 'end']);
+
+function decodeString(raw: string): string {
+	return raw.includes('\\') ? JSON.parse('"' + raw + '"') : raw;
+}
+
+/**
+ * Reads the top-level declarations of a Clang JSON AST from chunks of text.
+ * Only the declaration being read is kept in memory.
+ */
+export class ClangASTReader {
+	protected readonly stack: Frame[] = [];
+	protected readonly nodes: Node[] = [];
+
+	/** The text of the string or literal being read, which may span chunks */
+	protected token = '';
+	protected inString = false;
+	protected escaped = false;
+	protected expectKey = false;
+
+	/**
+	 * The file of the last location.
+	 * Clang leaves out the file of a location when it is the same as the previous one, even across declarations.
+	 */
+	protected file?: string;
+	protected includedFrom?: string;
+
+	public constructor(protected readonly options: ClangASTReaderOptions = {}) {}
+
+	/**
+	 * Reads a chunk of the AST, returning the top-level declarations completed by it
+	 */
+	public write(chunk: string): Node[] {
+		for (let i = 0; i < chunk.length; i++) {
+			if (this.inString) {
+				let end = i;
+				for (; end < chunk.length; end++) {
+					const c = chunk.charCodeAt(end);
+					if (this.escaped) this.escaped = false;
+					else if (c == 0x5c /* \ */) this.escaped = true;
+					else if (c == 0x22 /* " */) break;
+				}
+
+				this.token += chunk.slice(i, end);
+				i = end;
+				if (end == chunk.length) break;
+
+				this.inString = false;
+				const raw = this.token;
+				this.token = '';
+				this.string(raw);
+				continue;
+			}
+
+			switch (chunk.charCodeAt(i)) {
+				case 0x22 /* " */:
+					this.inString = true;
+					break;
+				case 0x7b /* { */:
+					this.open(false);
+					break;
+				case 0x5b /* [ */:
+					this.open(true);
+					break;
+				case 0x7d /* } */:
+				case 0x5d /* ] */:
+					this.flush();
+					this.close();
+					break;
+				case 0x2c /* , */:
+					this.flush();
+					this.expectKey = !!this.stack.length && !this.stack.at(-1)!.isArray;
+					break;
+				case 0x3a /* : */:
+					break;
+				case 0x20:
+				case 0x09:
+				case 0x0a:
+				case 0x0d:
+					this.flush();
+					break;
+				default:
+					this.token += chunk[i];
+			}
+		}
+
+		return this.nodes.splice(0);
+	}
+
+	/**
+	 * Checks that the whole AST was read
+	 */
+	public end(): void {
+		this.flush();
+		if (this.inString || this.stack.length) throw new SyntaxError('Unexpected end of Clang JSON AST');
+	}
+
+	/**
+	 * Whether the top of the stack is the `inner` array of the translation unit
+	 */
+	protected get atTopLevel(): boolean {
+		return this.stack.length == 2 && this.stack[0].key == 'inner';
+	}
+
+	protected open(isArray: boolean): void {
+		const parent = this.stack.at(-1);
+
+		if (parent?.key && locationKeys.has(parent.key) && !parent.isArray) this.includedFrom = undefined;
+
+		const keep = this.atTopLevel || parent?.value !== undefined;
+		this.stack.push({ isArray, value: keep ? (isArray ? [] : {}) : undefined });
+		this.expectKey = !isArray;
+	}
+
+	protected close(): void {
+		const frame = this.stack.pop();
+		if (!frame) throw new SyntaxError('Unexpected end of container in Clang JSON AST');
+		this.expectKey = false;
+
+		if (this.atTopLevel) {
+			if (frame.value) this.nodes.push(frame.value as unknown as Node);
+			return;
+		}
+
+		// The location of a top-level declaration was read, so it can be skipped without reading the rest
+		const decl = this.stack.at(-1);
+		if (this.stack.length == 3 && this.stack[0].key == 'inner' && decl?.key == 'loc') {
+			const implicit = !frame.value || !Object.keys(frame.value).length;
+			if (this.options.skip?.(implicit ? undefined : this.file, implicit ? undefined : this.includedFrom)) {
+				decl.value = undefined;
+				return;
+			}
+		}
+
+		this.add(frame.value);
+	}
+
+	protected string(raw: string): void {
+		const top = this.stack.at(-1);
+		if (top && !top.isArray && this.expectKey) {
+			top.key = decodeString(raw);
+			this.expectKey = false;
+			return;
+		}
+
+		// Strings in skipped values are only decoded when needed to track the file of locations
+		if (top?.value === undefined && top?.key != 'file') return;
+		this.value(decodeString(raw));
+	}
+
+	/**
+	 * Finishes reading a number, `true`, `false`, or `null`
+	 */
+	protected flush(): void {
+		if (!this.token) return;
+		const token = this.token;
+		this.token = '';
+		this.value(JSON.parse(token));
+	}
+
+	protected value(value: unknown): void {
+		const top = this.stack.at(-1);
+
+		if (top?.key == 'file' && typeof value == 'string') {
+			if (this.stack.at(-2)?.key == 'includedFrom') this.includedFrom = value;
+			else this.file = value;
+		}
+
+		this.add(value);
+	}
+
+	protected add(value: unknown): void {
+		const parent = this.stack.at(-1);
+		if (value === undefined || parent?.value === undefined) return;
+		if (Array.isArray(parent.value)) parent.value.push(value);
+		else parent.value[parent.key!] = value;
+	}
+}
+
+/**
+ * Reads the top-level declarations of a Clang JSON AST from a file, one at a time
+ */
+export function* readClangASTSync(path: string, options: ClangASTReaderOptions = {}): Generator<Node> {
+	const reader = new ClangASTReader(options);
+	const decoder = new TextDecoder();
+	const buffer = Buffer.allocUnsafe(chunkSize);
+	const fd = openSync(path, 'r');
+
+	try {
+		let read: number;
+		while ((read = readSync(fd, buffer)) > 0) {
+			yield* reader.write(decoder.decode(buffer.subarray(0, read), { stream: true }));
+		}
+		yield* reader.write(decoder.decode());
+		reader.end();
+	} finally {
+		closeSync(fd);
+	}
+}
+
+/**
+ * Like `readClangASTSync`, but the file is read asynchronously
+ */
+export async function* readClangAST(path: string, options: ClangASTReaderOptions = {}): AsyncGenerator<Node> {
+	const reader = new ClangASTReader(options);
+
+	for await (const chunk of createReadStream(path, { encoding: 'utf8', highWaterMark: chunkSize })) {
+		yield* reader.write(chunk);
+	}
+
+	reader.end();
+}
+
+/**
+ * Reads the top-level declarations of a Clang JSON AST that is already in memory
+ */
+export function readClangASTSource(source: string, options: ClangASTReaderOptions = {}): Node[] {
+	const reader = new ClangASTReader(options);
+	const nodes = reader.write(source);
+	reader.end();
+	return nodes;
+}
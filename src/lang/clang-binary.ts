@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (c) 2025 James Prevett
+/**
+ * Decoding for the compact binary AST format produced by the native addon.
+ *
+ * All integers are little-endian.
+ * The header is 10 u32s: magic ("XAST"), version, node count, type count, string count,
+ * the byte offsets of the node, type, and string tables, then the argument count and the byte offset of the argument table.
+ *
+ * Each node is 16 u32s, in pre-order:
+ * kind, id, name, tagUsed, size (of the subtree, including the node), line, col, offset, tokLen, file,
+ * type, referenced declaration name, referenced declaration type, value kind, then 8 bytes of value.
+ *
+ * Each type is 12 u32s: qualType, desugaredQualType, structure, qualifier flags (const = 1, volatile = 2, restrict = 4),
+ * name, tag, anonymous declaration ID, inner type, array length, start and count of function arguments, then padding.
+ * Function arguments are u32 type indices.
+ * Each string is a u32 offset and u32 length of UTF-8 bytes.
+ * Anything that refers to a string or type uses `0xFFFFFFFF` for none.
+ */
+import type { Node, TypeInfo } from './clang.js';
+
+const magic = 0x54534158;
+const version = 2;
+const none = 0xffffffff;
+
+const nodeWords = 16;
+const typeWords = 12;
+
+const enum ValueKind {
+	None,
+	Signed,
+	Unsigned,
+	Float,
+	String,
+}
+
+const decoder = new TextDecoder();
+
+/**
+ * Integers are only BigInts when they can't be represented exactly as a Number, like the native addon's JS nodes
+ */
+function safeInteger(value: bigint): bigint | number {
+	return value >= -Number.MAX_SAFE_INTEGER && value <= Number.MAX_SAFE_INTEGER ? Number(value) : value;
+}
+
+class BinaryAST {
+	protected readonly view: DataView;
+	protected readonly bytes: Uint8Array;
+	protected readonly nodeCount: number;
+	protected readonly nodesOffset: number;
+	protected readonly typesOffset: number;
+	protected readonly stringsOffset: number;
+	protected readonly argsOffset: number;
+	protected readonly strings: (string | undefined)[];
+	protected readonly types: (TypeInfo | undefined)[];
+
+	public constructor(buffer: ArrayBuffer) {
+		this.view = new DataView(buffer);
+		this.bytes = new Uint8Array(buffer);
+
+		if (this.view.getUint32(0, true) != magic) throw new Error('Invalid binary AST');
+		const bufferVersion = this.view.getUint32(4, true);
+		if (bufferVersion != version) throw new Error('Unsupported binary AST version: ' + bufferVersion);
+
+		this.nodeCount = this.view.getUint32(8, true);
+		this.types = new Array(this.view.getUint32(12, true));
+		this.strings = new Array(this.view.getUint32(16, true));
+		this.nodesOffset = this.view.getUint32(20, true);
+		this.typesOffset = this.view.getUint32(24, true);
+		this.stringsOffset = this.view.getUint32(28, true);
+		this.argsOffset = this.view.getUint32(36, true);
+	}
+
+	/** Gets a field of a node */
+	public field(node: number, field: number): number {
+		return this.view.getUint32(this.nodesOffset + (node * nodeWords + field) * 4, true);
+	}
+
+	/** Strings are only decoded when first used */
+	public string(index: number): string | undefined {
+		if (index == none) return;
+		if (this.strings[index] !== undefined) return this.strings[index];
+
+		const start = this.view.getUint32(this.stringsOffset + index * 8, true);
+		const length = this.view.getUint32(this.stringsOffset + index * 8 + 4, true);
+		return (this.strings[index] = decoder.decode(this.bytes.subarray(start, start + length)));
+	}
+
+	/** Types are deduplicated, so the same object is shared by every node with that type */
+	public type(index: number): TypeInfo | undefined {
+		if (index == none) return;
+		if (this.types[index]) return this.types[index];
+
+		const offset = this.typesOffset + index * typeWords * 4;
+		const field = (i: number) => this.view.getUint32(offset + i * 4, true);
+
+		const flags = field(3),
+			length = field(8),
+			argsStart = field(9);
+
+		const args: TypeInfo[] = [];
+		if (argsStart != none)
+			for (let i = 0; i < field(10); i++)
+				args.push(this.type(this.view.getUint32(this.argsOffset + (argsStart + i) * 4, true))!);
+
+		return (this.types[index] = {
+			qualType: this.string(field(0))!,
+			desugaredQualType: this.string(field(1)),
+			structure: this.string(field(2)) as TypeInfo['structure'],
+			const: !!(flags & 1),
+			volatile: !!(flags & 2),
+			restrict: !!(flags & 4),
+			name: this.string(field(4)),
+			tag: this.string(field(5)) as TypeInfo['tag'],
+			declId: this.string(field(6)),
+			inner: this.type(field(7)),
+			length: length == none ? undefined : length,
+			args: argsStart == none ? undefined : args,
+		});
+	}
+
+	public value(node: number): bigint | number | string | undefined {
+		const offset = this.nodesOffset + (node * nodeWords + 14) * 4;
+		switch (this.field(node, 13) as ValueKind) {
+			case ValueKind.Signed:
+				return safeInteger(this.view.getBigInt64(offset, true));
+			case ValueKind.Unsigned:
+				return safeInteger(this.view.getBigUint64(offset, true));
+			case ValueKind.Float:
+				return this.view.getFloat64(offset, true);
+			case ValueKind.String:
+				return this.string(this.view.getUint32(offset, true));
+			case ValueKind.None:
+				return;
+		}
+	}
+
+	public roots(): Node[] {
+		const roots: Node[] = [];
+		for (let i = 0; i < this.nodeCount; i += this.field(i, 4)) roots.push(new LazyNode(this, i) as any as Node);
+		return roots;
+	}
+}
+
+/**
+ * A node backed by the binary AST.
+ * Fields are read from the buffer when accessed, so nodes that are skipped are never fully decoded.
+ */
+class LazyNode {
+	#inner?: Node[];
+	#type?: TypeInfo;
+	#hasType = false;
+
+	public constructor(
+		protected readonly ast: BinaryAST,
+		protected readonly index: number
+	) {}
+
+	public get kind(): string {
+		return this.ast.string(this.ast.field(this.index, 0))!;
+	}
+
+	public get id(): string {
+		return this.ast.string(this.ast.field(this.index, 1))!;
+	}
+
+	public get name(): string {
+		return this.ast.string(this.ast.field(this.index, 2))!;
+	}
+
+	public get tagUsed(): string | undefined {
+		return this.ast.string(this.ast.field(this.index, 3));
+	}
+
+	public get loc() {
+		const { ast, index } = this;
+		return {
+			line: ast.field(index, 5),
+			col: ast.field(index, 6),
+			offset: ast.field(index, 7),
+			tokLen: ast.field(index, 8),
+			file: ast.string(ast.field(index, 9)),
+		};
+	}
+
+	public get type(): TypeInfo | undefined {
+		return this.#hasType ? this.#type : this.ast.type(this.ast.field(this.index, 10));
+	}
+
+	public set type(value: TypeInfo | undefined) {
+		this.#hasType = true;
+		this.#type = value;
+	}
+
+	public get value(): bigint | number | string | undefined {
+		return this.ast.value(this.index);
+	}
+
+	public get referencedDecl(): { name: string; type?: TypeInfo } | undefined {
+		const name = this.ast.string(this.ast.field(this.index, 11));
+		if (name === undefined) return;
+		const type = this.ast.type(this.ast.field(this.index, 12));
+		return type ? { name, type } : { name };
+	}
+
+	public get inner(): Node[] {
+		if (this.#inner) return this.#inner;
+
+		const { ast, index } = this;
+		const inner: Node[] = [];
+		for (let child = index + 1, end = index + ast.field(index, 4); child < end; child += ast.field(child, 4))
+			inner.push(new LazyNode(ast, child) as any as Node);
+
+		return (this.#inner = inner);
+	}
+
+	public toJSON() {
+		const { kind, tagUsed, id, name, loc, value, type, referencedDecl, inner } = this;
+		return { kind, tagUsed, id, name, loc, value, type, referencedDecl, inner };
+	}
+}
+
+/**
+ * Decodes an AST returned by the native addon with the `binary` option
+ */
+export function decodeAST(buffer: ArrayBuffer): Node[] {
+	return new BinaryAST(buffer).roots();
+}
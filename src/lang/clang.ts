@@ -1,7 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 // Copyright (c) 2025 James Prevett
 import * as xir from '../ir.js';
-import { __entry, createIssueHelpers, getSource } from '../issue.js';
+import { __entry, createIssueHelpers, getLineColumn, getSource } from '../issue.js';
 
 interface _Location {
 	offset: number;
@@ -32,16 +32,21 @@ const { error, warning, note, debug } = createIssueHelpers<Node>(function __node
 	if (!rawLoc) return {};
 
 	const alt = _parseLocation(node.range?.end);
+	const file = rawLoc.file ?? rawLoc.includedFrom?.file ?? __entry;
+
+	// Clang's JSON AST leaves out the line when it is the same as the previous node's
+	const computed =
+		rawLoc.line === undefined || rawLoc.col === undefined ? getLineColumn(file, rawLoc.offset) : undefined;
 
 	return {
 		location: {
-			line: rawLoc.line ?? alt?.line,
-			column: rawLoc.col ?? alt?.col,
+			line: rawLoc.line ?? computed?.line ?? alt?.line,
+			column: rawLoc.col ?? computed?.column ?? alt?.col,
 			position: rawLoc.offset,
-			unit: rawLoc.file ?? rawLoc.includedFrom?.file ?? __entry ?? '<unknown>',
+			unit: file ?? '<unknown>',
 			length: rawLoc.tokLen,
 		},
-		source: getSource(rawLoc.file ?? rawLoc.includedFrom?.file ?? __entry, rawLoc.offset),
+		source: getSource(file, rawLoc.offset),
 	};
 });
 
@@ -51,6 +56,28 @@ export interface TypeInfo {
 	desugaredQualType?: string;
 	qualType: string;
 	typeAliasDeclId?: string;
+
+	/*
+		Structured types, only from the native addon.
+		These are used instead of parsing qualType, except for unexposed types.
+	*/
+
+	structure?: 'builtin' | 'pointer' | 'array' | 'function' | 'record' | 'enum' | 'typedef' | 'unexposed';
+	const?: boolean;
+	volatile?: boolean;
+	restrict?: boolean;
+	/** For builtins, typedefs, records, and enums, the unqualified spelling without the tag */
+	name?: string;
+	/** For records and enums spelled with their tag */
+	tag?: 'struct' | 'union' | 'enum';
+	/** For anonymous records and enums, the ID of the declaration */
+	declId?: string;
+	/** The pointee, array element, function return type, or the type a typedef resolves to */
+	inner?: TypeInfo;
+	/** The length of a constant array */
+	length?: number;
+	/** Function argument types */
+	args?: TypeInfo[];
 }
 
 export interface GenericNode {
@@ -180,6 +207,31 @@ function parseBaseType(type: string): string {
 	return type;
 }
 
+/**
+ * 53-bit hash of a string (cyrb53)
+ */
+function _hash(value: string): number {
+	let h1 = 0xdeadbeef,
+		h2 = 0x41c6ce57;
+	for (let i = 0; i < value.length; i++) {
+		const c = value.charCodeAt(i);
+		h1 = Math.imul(h1 ^ c, 2654435761);
+		h2 = Math.imul(h2 ^ c, 1597334677);
+	}
+	h1 = Math.imul(h1 ^ (h1 >>> 16), 2246822507) ^ Math.imul(h2 ^ (h2 >>> 13), 3266489909);
+	h2 = Math.imul(h2 ^ (h2 >>> 16), 2246822507) ^ Math.imul(h1 ^ (h1 >>> 13), 3266489909);
+	return 4294967296 * (2097151 & h2) + (h1 >>> 0);
+}
+
+/**
+ * Gets the name used for a declaration without one (e.g. an anonymous struct or a label), from its ID.
+ * IDs are either addresses like `0x1f` or USRs, which can contain any character,
+ * so USRs are replaced by a hash that is the same for the declaration in every translation unit.
+ */
+function _idName(id: string): string {
+	return '_' + (/^\w+$/.test(id) ? id : 'usr' + _hash(id).toString(36));
+}
+
 const _type_anonymous = /^(.*)\((?:unnamed(?: \w+)?|anonymous) at (.*)\)$/;
 const _type_namespace = /^(struct|union|enum) (.*)/;
 const _type_function = /^([^(]+)\s+\((.*)\)/;
@@ -216,7 +268,7 @@ function _parseType($: ParseTypeContext, type: string | null): xir.Type {
 					.join('');
 		if (process.env.DEBUG_TYPE_STACK)
 			info += `\nanon_alt=${JSON.stringify($.anon_alt)}\nraw=${JSON.stringify($.raw)}\nCall stack:\n${new Error().stack?.slice(6)}`;
-		throw error('BUG! Infinite loop while parsing type: ' + info, $.node);
+		throw error('BUG! Infinite loop while parsing type: ' + info, $.node, 'BUG! Infinite loop while parsing type');
 	}
 
 	$ = { ...$, stack: [...$.stack, type] };
@@ -229,7 +281,7 @@ function _parseType($: ParseTypeContext, type: string | null): xir.Type {
 			$.anon_alt = null;
 			return _parseType($, $.anon_alt);
 		} else {
-			warning(`Unable to resolve anonymous type: ${isAnonymous}`, $.node);
+			warning(`Unable to resolve anonymous type: ${isAnonymous}`, $.node, 'Unable to resolve anonymous type');
 			return { kind: 'plain', text: 'any' };
 		}
 	}
@@ -240,7 +292,7 @@ function _parseType($: ParseTypeContext, type: string | null): xir.Type {
 		try {
 			return { kind: 'typeof', target: _parseType($, typeofTarget.trim()) };
 		} catch (e) {
-			warning('Unable to parse type: ' + isTypeOf, $.node);
+			warning('Unable to parse type: ' + isTypeOf, $.node, 'Unable to parse type');
 			return { kind: 'plain', text: 'any' };
 		}
 	}
@@ -289,27 +341,95 @@ function _parseType($: ParseTypeContext, type: string | null): xir.Type {
 	};
 }
 
+/**
+ * Parses a type from its spelling
+ */
+function _parseTypeSpelling(node: Node, _: TypeInfo): xir.Type {
+	const isRaw = !!(_type_typeof.test(_.qualType) && _.desugaredQualType);
+
+	return _parseType(
+		{
+			node,
+			anon_alt:
+				_.desugaredQualType && _type_anonymous.test(_.desugaredQualType) ? _.desugaredQualType : undefined,
+			isRaw,
+			stack: [],
+			raw: isRaw ? null : _.desugaredQualType,
+		},
+		isRaw ? _.desugaredQualType! : _.qualType
+	);
+}
+
+/**
+ * Converts a structured type from the native addon.
+ * Unexposed types don't have a structure, so they are parsed from their spelling.
+ */
+function _convertType(node: Node, info: TypeInfo): xir.Type {
+	let type: xir.Type;
+	switch (info.structure) {
+		case 'builtin':
+			type = { kind: 'plain', text: parseBaseType(info.name!) };
+			break;
+		case 'pointer':
+			// Function pointers are treated as functions
+			type =
+				info.inner!.structure == 'function'
+					? _convertType(node, info.inner!)
+					: { kind: 'ref', restricted: info.restrict, to: _convertType(node, info.inner!) };
+			break;
+		case 'array':
+			type = { kind: 'array', length: info.length ?? null, element: _convertType(node, info.inner!) };
+			break;
+		case 'function':
+			type = {
+				kind: 'function',
+				returns: _convertType(node, info.inner!),
+				args: info.args!.map(arg => _convertType(node, arg)),
+			};
+			break;
+		case 'record':
+		case 'enum':
+			if (info.declId) type = { kind: 'plain', text: _idName(info.declId) };
+			else if (info.tag)
+				type = { kind: 'namespaced', namespace: info.tag, inner: { kind: 'plain', text: info.name! } };
+			else type = { kind: 'plain', text: info.name! };
+			break;
+		case 'typedef':
+			type = { kind: 'plain', text: parseBaseType(info.name!), raw: _convertType(node, info.inner!) };
+			break;
+		default:
+			return _parseTypeSpelling(node, info);
+	}
+
+	if (info.volatile) type = { kind: 'qual', qualifier: 'volatile', inner: type };
+	if (info.const) type = { kind: 'qual', qualifier: 'const', inner: type };
+	return type;
+}
+
+/**
+ * Parsed types, by type info.
+ * The native addon shares type info objects between nodes with the same type, so each type is only parsed once.
+ */
+const _parsedTypes = new WeakMap<TypeInfo, xir.Type>();
+
 function parseType(node: Node, type: Node | string): xir.Type {
 	if (typeof type != 'string') {
 		const _ = node.type ?? {};
 
 		if (node.kind == 'ElaboratedType' && node.ownedTagDecl && !node.ownedTagDecl.name) {
-			return { kind: 'plain', text: '_' + node.ownedTagDecl.id, raw: parseType(node, node.type.qualType) };
+			return {
+				kind: 'plain',
+				text: _idName(node.ownedTagDecl.id),
+				raw: parseType(node, node.type.qualType),
+			};
 		}
 
-		const isRaw = !!(_type_typeof.test(_.qualType) && _.desugaredQualType);
+		const cached = node.type && _parsedTypes.get(node.type);
+		if (cached) return cached;
 
-		return _parseType(
-			{
-				node,
-				anon_alt:
-					_.desugaredQualType && _type_anonymous.test(_.desugaredQualType) ? _.desugaredQualType : undefined,
-				isRaw,
-				stack: [],
-				raw: isRaw ? null : _.desugaredQualType,
-			},
-			isRaw ? _.desugaredQualType! : _.qualType
-		);
+		const parsed = _.structure ? _convertType(node, _) : _parseTypeSpelling(node, _);
+		if (node.type) _parsedTypes.set(node.type, parsed);
+		return parsed;
 	}
 
 	type = type.trim();
@@ -510,6 +630,13 @@ export interface DeprecatedAttr extends GenericNode {
 	message: string;
 }
 
+/**
+ * Replaces a top-level declaration that was already parsed in the same native session
+ */
+export interface SessionReference extends GenericNode {
+	kind: 'SessionReference';
+}
+
 export type Node =
 	| Attribute
 	| BinaryOperator
@@ -523,6 +650,7 @@ export type Node =
 	| Label
 	| Member
 	| RecoveryExpr
+	| SessionReference
 	| Statement
 	| Type
 	| TypeOfExprType
@@ -564,6 +692,46 @@ function _parseFirst<T extends xir.Unit>(node: Node): T {
 
 const unnamedRecord = new Map<string, xir.RecordLike>();
 
+/**
+ * @todo Don't use global state
+ */
+let _declarationsOnly = false;
+
+/**
+ * When set, only declarations are lowered: function bodies and initializers are dropped,
+ * and functions, variables, and typedefs are kept even if they are unused.
+ */
+export function _setDeclarationsOnly(value: boolean) {
+	_declarationsOnly = value;
+}
+
+/**
+ * Parses a chain of binary operators like `a + b + c`, which nest on the left.
+ * Generated code can have chains with thousands of terms, so the chain is walked iteratively instead of recursively.
+ */
+function _parseBinaryChain(node: BinaryOperator): xir.Binary {
+	const chain: BinaryOperator[] = [node];
+	let left = node.inner[0];
+	while (left?.kind == 'BinaryOperator' && left.opcode != '__extension__') {
+		chain.push(left);
+		left = left.inner[0];
+	}
+
+	let result = parse<xir.Expression>(chain.at(-1)!.inner[0]);
+	for (let i = chain.length - 1; i >= 0; i--) {
+		result = [
+			{
+				kind: 'binary',
+				operator: chain[i].opcode as xir.Binary['operator'],
+				left: result,
+				right: parse(chain[i].inner[1]),
+			},
+		];
+	}
+
+	return result[0] as xir.Binary;
+}
+
 function* parseRaw(node: Node): Generator<xir.Unit> {
 	switch (node.kind) {
 		case 'BuiltinType':
@@ -612,6 +780,12 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 			return;
 		}
 		case 'BinaryOperator':
+			if (node.opcode == '__extension__') {
+				// _warn('__extension__ is not supported');
+				return;
+			}
+			yield _parseBinaryChain(node);
+			return;
 		case 'CompoundAssignOperator': {
 			const [left, right] = node.inner;
 
@@ -620,11 +794,11 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 				return;
 			}
 			yield {
-				kind: node.kind == 'BinaryOperator' ? 'binary' : 'assignment',
+				kind: 'assignment',
 				operator: node.opcode,
 				left: parse(left),
 				right: parse(right),
-			} as xir.Assignment | xir.Binary;
+			} as xir.Assignment;
 			return;
 		}
 		case 'BreakStmt':
@@ -709,6 +883,10 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 			};
 			return;
 		case 'VarDecl':
+			if (_declarationsOnly) {
+				yield { kind: 'declaration', name: node.name, type: parseType(node, node), storage: 'extern' };
+				return;
+			}
 			if (!node.isUsed) return;
 			yield {
 				kind: 'declaration',
@@ -734,14 +912,15 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 
 			const u = {
 				kind: node.kind == 'EnumDecl' ? 'enum' : node.tagUsed!,
-				name: node.name ?? '_' + node.id,
+				name: node.name || _idName(node.id),
 				subRecords,
 				complete: node.completeDefinition,
 				fields: (node.inner ?? [])
 					.flatMap((node, i) => {
 						if (node.kind != 'RecordDecl') {
 							if (i - 1 === lastSubRecord) {
-								node.type.qualType = subRecords.at(-1)?.name ?? node.type.qualType;
+								// Type info may be shared between nodes, so it is replaced rather than modified
+								node.type = { ...node.type, qualType: subRecords.at(-1)?.name ?? node.type.qualType };
 							}
 							return parse(node);
 						}
@@ -793,14 +972,14 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 			return;
 		}
 		case 'FunctionDecl': {
-			if (!node.isUsed && node.name != 'main') return;
-			const [return_t] = node.type.qualType.replace(')', '').split('(');
-			const body = node.inner?.find(param => param.kind == 'CompoundStmt');
+			if (!node.isUsed && node.name != 'main' && !_declarationsOnly) return;
+			const [return_t] = node.type.structure == 'function' ? [] : node.type.qualType.replace(')', '').split('(');
+			const body = _declarationsOnly ? undefined : node.inner?.find(param => param.kind == 'CompoundStmt');
 
 			yield {
 				kind: 'function',
 				name: node.name,
-				returns: parseType(node, return_t),
+				returns: return_t === undefined ? _convertType(node, node.type.inner!) : parseType(node, return_t),
 				exported: node.name == 'main',
 				parameters:
 					node.inner
@@ -816,7 +995,7 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 			return;
 		}
 		case 'GotoStmt':
-			yield { kind: 'goto', target: '_' + node.targetLabelDeclId };
+			yield { kind: 'goto', target: _idName(node.targetLabelDeclId) };
 			return;
 		case 'IfStmt': {
 			const [condition, body, _else] = node.inner!;
@@ -840,7 +1019,7 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 			return;
 		case 'LabelStmt':
 			yield { kind: 'comment', text: 'label: ' + node.name };
-			yield { kind: 'label', name: '_' + node.declId };
+			yield { kind: 'label', name: _idName(node.declId) };
 			return;
 		case 'DeclRefExpr':
 			yield {
@@ -870,6 +1049,9 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 		case 'ReturnStmt':
 			yield { kind: 'return', value: !node.inner ? [] : parse(node.inner[0]) };
 			return;
+		case 'SessionReference':
+			// Already translated with an earlier file in the session
+			return;
 		case 'StaticAssertDecl':
 		case 'StaticAssert': {
 			const [condition, message] = node.inner ?? [];
@@ -878,7 +1060,7 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 				const [{ content: messageContent }] = parse<xir.Value>(message);
 				let text = 'Static assertion failed';
 				if (messageContent) text += ': ' + String(messageContent);
-				error(text, node);
+				error(text, node, 'Static assertion failed');
 			}
 			return;
 		}
@@ -892,12 +1074,12 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 			return;
 		}
 		case 'TypedefDecl': {
-			if (!node.isReferenced) return;
+			if (!node.isReferenced && !_declarationsOnly) return;
 			if (['__builtin_ms_va_list', '__builtin_va_list', '__NSConstantString'].includes(node.name)) return;
 			const [elaborated] = node.inner! as [ElaboratedType];
 			if (elaborated.ownedTagDecl) {
 				const record = unnamedRecord.get(elaborated.ownedTagDecl.id);
-				if (record && record.name == '_' + elaborated.ownedTagDecl.id) {
+				if (record && record.name == _idName(elaborated.ownedTagDecl.id)) {
 					record.name = node.name;
 					return;
 				}
@@ -965,8 +1147,12 @@ function* parseRaw(node: Node): Generator<xir.Unit> {
 			return;
 		}
 		default: {
-			// @ts-expect-error 2339 — should be never since all kinds we know about are covered already
-			throw error('Unable to parse unknown AST node of type ' + node.kind, node);
+			throw error(
+				// @ts-expect-error 2339 — should be never since all kinds we know about are covered already
+				'Unable to parse unknown AST node of type ' + node.kind,
+				node,
+				'Unable to parse unknown AST node'
+			);
 		}
 	}
 }
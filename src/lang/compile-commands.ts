@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (c) 2025 James Prevett
+/**
+ * Reading compilation databases (`compile_commands.json`)
+ * @see https://clang.llvm.org/docs/JSONCompilationDatabase.html
+ */
+import { readFile } from 'node:fs/promises';
+import { dirname, resolve } from 'node:path';
+
+export interface CompileCommand {
+	/** The working directory of the compilation */
+	directory: string;
+	file: string;
+	/** The compile command as a single shell-escaped string */
+	command?: string;
+	/** The compile command as a list of arguments. Takes precedence over `command` */
+	arguments?: string[];
+	output?: string;
+}
+
+/**
+ * A translation unit from a compilation database
+ */
+export interface ProjectEntry {
+	/** The absolute path of the main file */
+	file: string;
+	/** The arguments to pass to Clang */
+	args: string[];
+}
+
+/**
+ * Splits a shell command into arguments, handling quotes and backslash escapes
+ */
+function splitCommand(command: string): string[] {
+	const args: string[] = [];
+	let current = '',
+		inArg = false,
+		quote: string | undefined;
+
+	for (let i = 0; i < command.length; i++) {
+		const c = command[i];
+
+		if (quote) {
+			if (c == quote) quote = undefined;
+			else if (c == '\\' && quote == '"' && i + 1 < command.length) current += command[++i];
+			else current += c;
+			continue;
+		}
+
+		if (c == '"' || c == "'") {
+			quote = c;
+			inArg = true;
+		} else if (c == '\\' && i + 1 < command.length) {
+			current += command[++i];
+			inArg = true;
+		} else if (/\s/.test(c)) {
+			if (inArg) args.push(current);
+			current = '';
+			inArg = false;
+		} else {
+			current += c;
+			inArg = true;
+		}
+	}
+
+	if (inArg) args.push(current);
+	return args;
+}
+
+/**
+ * Gets the arguments Clang should parse an entry with.
+ * The compiler, the input and output files, and `-c` are removed.
+ * Relative paths in the arguments are resolved against the entry's directory by Clang.
+ */
+function entryArgs(entry: CompileCommand, file: string): string[] {
+	const raw = entry.arguments ?? splitCommand(entry.command ?? '');
+	const args: string[] = [];
+
+	for (let i = 1; i < raw.length; i++) {
+		const arg = raw[i];
+		if (arg == '-c') continue;
+		if (arg == '-o') {
+			i++;
+			continue;
+		}
+		if (arg.startsWith('-o') || arg == entry.file || resolve(entry.directory, arg) == file) continue;
+		args.push(arg);
+	}
+
+	args.push('-working-directory=' + entry.directory);
+	return args;
+}
+
+/**
+ * Reads the translation units in a compilation database.
+ * Relative directories are resolved against the directory of the database, so it can be moved with its sources.
+ */
+export async function readCompileCommands(path: string): Promise<ProjectEntry[]> {
+	const commands: CompileCommand[] = JSON.parse(await readFile(path, 'utf8'));
+
+	return commands.map(entry => {
+		entry = { ...entry, directory: resolve(dirname(path), entry.directory) };
+		const file = resolve(entry.directory, entry.file);
+		return { file, args: entryArgs(entry, file) };
+	});
+}
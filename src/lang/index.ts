@@ -1,10 +1,15 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 // Copyright (c) 2025 James Prevett
-import { readFileSync } from 'node:fs';
+import type { FSWatcher } from 'node:fs';
+import { watch as watchFile } from 'node:fs';
 import $pkg from '../../package.json' with { type: 'json' };
 import * as xir from '../ir.js';
-import { __setEntry } from '../issue.js';
+import { __setEntry, forgetSource, registerSource } from '../issue.js';
 import * as clang from './clang.js';
+import type { ClangASTReaderOptions } from './clang-ast-reader.js';
+import { readClangAST, readClangASTSource, readClangASTSync } from './clang-ast-reader.js';
+import { decodeAST } from './clang-binary.js';
+import { readCompileCommands } from './compile-commands.js';
 import * as ts from './typescript.js';
 import { cToTypescriptHeader } from './x-specific.js';
 // @ts-expect-error 2307
@@ -18,25 +23,208 @@ Object.defineProperty(BigInt.prototype, 'toJSON', {
 	},
 });
 
+/**
+ * Top-level declarations shared by the parses in a session (native Clang only)
+ */
+export interface Session {
+	/** The number of distinct top-level declarations parsed in the session */
+	readonly size: number;
+	clear(): void;
+}
+
+export function createSession(): Session {
+	return new native.Session();
+}
+
 export interface ParseOptions {
 	/** If set, the exit codes of sub-shells are ignored */
 	ignoreExit?: boolean;
 
 	/** Override the entry point used for computing issue messages */
 	issueEntry?: string;
+
+	/** Only include top-level declarations from the main file */
+	mainFileOnly?: boolean;
+
+	/** Skip top-level declarations from system headers (native Clang only) */
+	skipSystemHeaders?: boolean;
+
+	/** Globs for headers to keep declarations from, even when they would otherwise be skipped */
+	keepHeaders?: string[];
+
+	/**
+	 * Globs for headers to skip top-level declarations from (Clang JSON AST only).
+	 * Skipped declarations are not kept in memory while the AST is read.
+	 */
+	excludeHeaders?: string[];
+
+	/** Only parse declarations, skipping function bodies */
+	declarationsOnly?: boolean;
+
+	/** Transfer the AST from the native addon in a compact binary format, which is decoded lazily */
+	binary?: boolean;
+
+	/**
+	 * Return cursor handles from the native addon instead of a full AST.
+	 * The translation unit is kept alive by the handles, and their properties are only computed when accessed.
+	 * Takes precedence over `binary`.
+	 */
+	lazy?: boolean;
+
+	/**
+	 * Use USRs as the IDs of declarations (native Clang only).
+	 * These are stable across translation units, but are expensive to compute.
+	 * By default, IDs are only unique within a translation unit.
+	 */
+	usr?: boolean;
+
+	/**
+	 * In-memory contents for the input or any headers, keyed by path.
+	 * These are used in place of the files on disk, so they don't need to exist.
+	 */
+	sources?: Record<string, string>;
+
+	/**
+	 * A directory to cache parsed translation units in (native Clang only).
+	 * Cached translation units are reused when none of the files they include have changed.
+	 */
+	cacheDir?: string;
+
+	/**
+	 * Top-level declarations that were already parsed in the session are skipped (native Clang only).
+	 * This way declarations from headers included by many files are only translated once.
+	 * USRs are used as IDs, so references to declarations from other files resolve.
+	 */
+	session?: Session;
+
+	/** Only collect top-level declarations of these kinds, e.g. `FunctionDecl` (native Clang only) */
+	includeKinds?: string[];
+
+	/** Skip nodes of these kinds, along with everything in them (native Clang only) */
+	excludeKinds?: string[];
+
+	/** For nodes of a kind, how many levels of their descendants to collect (native Clang only) */
+	maxDepth?: Record<string, number>;
 }
 
-export function parse(lang: string, file: string, opts: ParseOptions): Iterable<xir.Unit> {
+function _setup(opts: ParseOptions): void {
 	if (opts.issueEntry) __setEntry(opts.issueEntry);
+	for (const [path, contents] of Object.entries(opts.sources ?? {})) registerSource(path, contents);
+	clang._setDeclarationsOnly(!!opts.declarationsOnly);
+}
+
+/**
+ * The options passed to the native addon when getting a Clang AST
+ */
+function nativeOptions(opts: ParseOptions) {
+	return {
+		mainFileOnly: opts.mainFileOnly,
+		skipSystemHeaders: opts.skipSystemHeaders,
+		keepHeaders: opts.keepHeaders,
+		declarationsOnly: opts.declarationsOnly,
+		binary: opts.binary,
+		lazy: opts.lazy,
+		usr: opts.usr,
+		unsaved: opts.sources,
+		cacheDir: opts.cacheDir,
+		session: opts.session,
+		includeKinds: opts.includeKinds,
+		excludeKinds: opts.excludeKinds,
+		maxDepth: opts.maxDepth,
+	};
+}
+
+/**
+ * Gets the nodes from an AST returned by the native addon, which is an `ArrayBuffer` when using the binary format
+ */
+function nativeNodes(ast: clang.Node[] | ArrayBuffer): clang.Node[] {
+	return ast instanceof ArrayBuffer ? decodeAST(ast) : ast;
+}
+
+/**
+ * Converts a glob to a regular expression, matching like `fnmatch` does for the native addon
+ */
+function globToRegExp(glob: string): RegExp {
+	const source = glob.replace(/[.+^${}()|\\]/g, '\\$&').replaceAll('*', '.*').replaceAll('?', '.');
+	return new RegExp('^' + source + '$');
+}
+
+/**
+ * The options used when reading a Clang JSON AST
+ */
+function clangASTOptions(opts: ParseOptions): ClangASTReaderOptions {
+	const keep = (opts.keepHeaders ?? []).map(globToRegExp),
+		exclude = (opts.excludeHeaders ?? []).map(globToRegExp);
+
+	if (!opts.mainFileOnly && !exclude.length) return {};
+
+	return {
+		skip(file, includedFrom) {
+			// Declarations in the main file don't have an `includedFrom`
+			if (!file || !includedFrom) return false;
+			if (keep.some(glob => glob.test(file))) return false;
+			return !!opts.mainFileOnly || exclude.some(glob => glob.test(file));
+		},
+	};
+}
+
+/**
+ * Reads the top-level declarations of a Clang JSON AST one at a time, so the whole AST is never held in memory.
+ */
+function* parseClangAST(file: string, opts: ParseOptions): Generator<xir.Unit> {
+	const nodes =
+		file in (opts.sources ?? {})
+			? readClangASTSource(opts.sources![file], clangASTOptions(opts))
+			: readClangASTSync(file, clangASTOptions(opts));
+
+	for (const node of nodes) yield* clang.parse(node);
+}
+
+/**
+ * Like `parseClangAST`, but the file is read asynchronously
+ */
+async function* parseClangASTAsync(file: string, opts: ParseOptions): AsyncGenerator<xir.Unit> {
+	if (file in (opts.sources ?? {})) {
+		yield* parseClangAST(file, opts);
+		return;
+	}
+
+	for await (const node of readClangAST(file, clangASTOptions(opts))) yield* clang.parse(node);
+}
+
+export interface ParseManyOptions extends ParseOptions {
+	/** The number of files to parse at once. Defaults to the number of CPUs */
+	concurrency?: number;
+
+	/**
+	 * Only translate each top-level declaration once, in the first file that has it.
+	 * This creates a session if one isn't provided.
+	 */
+	dedupe?: boolean;
+}
+
+/**
+ * The options passed to the native addon when getting the Clang ASTs of many files
+ */
+function manyOptions(opts: ParseManyOptions) {
+	return {
+		...nativeOptions(opts),
+		session: opts.session ?? (opts.dedupe ? createSession() : undefined),
+		concurrency: opts.concurrency,
+	};
+}
+
+export function parse(lang: string, file: string, opts: ParseOptions): Iterable<xir.Unit> {
+	_setup(opts);
 
 	switch (lang) {
 		case 'clang-ast':
-			return clang.parse(JSON.parse(readFileSync(file, 'utf8')));
+			return parseClangAST(file, opts);
 		case 'c':
 		case 'clang': {
 			__setEntry(file);
 			const ir: xir.Unit[] = [],
-				nodes = native.getClangAST(file, []);
+				nodes = nativeNodes(native.getClangAST(file, [], nativeOptions(opts)));
 			for (const node of nodes) ir.push(...clang.parse(node));
 			return ir;
 		}
@@ -45,6 +233,181 @@ export function parse(lang: string, file: string, opts: ParseOptions): Iterable<
 	}
 }
 
+/**
+ * Like `parse`, but Clang parses and walks the AST off of the main thread.
+ */
+export async function parseAsync(lang: string, file: string, opts: ParseOptions): Promise<xir.Unit[]> {
+	_setup(opts);
+
+	switch (lang) {
+		case 'clang-ast': {
+			const ir: xir.Unit[] = [];
+			for await (const unit of parseClangASTAsync(file, opts)) ir.push(unit);
+			return ir;
+		}
+		case 'c':
+		case 'clang': {
+			__setEntry(file);
+			const ir: xir.Unit[] = [],
+				nodes = nativeNodes(await native.getClangASTAsync(file, [], nativeOptions(opts)));
+			for (const node of nodes) ir.push(...clang.parse(node));
+			return ir;
+		}
+		default:
+			throw new Error('Unsupported source language: ' + lang);
+	}
+}
+
+/**
+ * Like `parseAsync`, but yields units as each top-level declaration is parsed.
+ * For C, Clang walks the AST on a native thread and hands off each top-level declaration as soon as it is visited,
+ * so the whole AST is never held in memory at once.
+ * The same is true of Clang JSON ASTs, which are read incrementally.
+ */
+export async function* parseStream(lang: string, file: string, opts: ParseOptions): AsyncGenerator<xir.Unit> {
+	if (lang == 'clang-ast') {
+		_setup(opts);
+		yield* parseClangASTAsync(file, opts);
+		return;
+	}
+
+	if (lang != 'c' && lang != 'clang') {
+		yield* await parseAsync(lang, file, opts);
+		return;
+	}
+
+	_setup(opts);
+	__setEntry(opts.issueEntry ?? file);
+
+	// The native walk waits once a few declarations are pending, until `pull` is called as each is consumed
+	const pending: (clang.Node[] | ArrayBuffer)[] = [];
+	let wake: (() => void) | undefined,
+		done = false,
+		error: unknown;
+
+	const stream = native.getClangASTStream(file, [], nativeOptions(opts), (ast: clang.Node[] | ArrayBuffer) => {
+		pending.push(ast);
+		wake?.();
+	});
+
+	stream.done
+		.catch((e: unknown) => (error = e))
+		.finally(() => {
+			done = true;
+			wake?.();
+		});
+
+	try {
+		while (true) {
+			const ast = pending.shift();
+			if (ast) {
+				stream.pull();
+				for (const node of nativeNodes(ast)) yield* clang.parse(node);
+				continue;
+			}
+
+			if (done) break;
+			await new Promise<void>(resolve => (wake = resolve));
+			wake = undefined;
+		}
+	} finally {
+		// Otherwise the native walk would wait forever if the consumer stops early
+		stream.cancel();
+	}
+
+	if (error) throw error;
+}
+
+/**
+ * Parse many files, with Clang parsing them in parallel on native threads.
+ * Results are in the same order as `files`.
+ */
+export async function parseMany(lang: string, files: string[], opts: ParseManyOptions): Promise<xir.Unit[][]> {
+	_setup(opts);
+
+	switch (lang) {
+		case 'c':
+		case 'clang': {
+			const asts = await native.getClangASTMany(files, [], manyOptions(opts));
+			return asts.map((ast: clang.Node[] | ArrayBuffer, i: number) => {
+				__setEntry(opts.issueEntry ?? files[i]);
+				const ir: xir.Unit[] = [];
+				for (const node of nativeNodes(ast)) ir.push(...clang.parse(node));
+				return ir;
+			});
+		}
+		default:
+			return await Promise.all(files.map(file => parseAsync(lang, file, opts)));
+	}
+}
+
+export interface ProjectUnit {
+	file: string;
+	units: xir.Unit[];
+}
+
+/**
+ * Parse every translation unit in a compilation database (`compile_commands.json`), each with its own arguments.
+ * Clang parses them in parallel on native threads. Results are in the same order as the database.
+ * USRs are always used as IDs, so the same declaration has the same ID in every file.
+ */
+export async function parseProject(compileCommands: string, opts: ParseManyOptions): Promise<ProjectUnit[]> {
+	_setup(opts);
+
+	const entries = await readCompileCommands(compileCommands);
+	const asts = await native.getClangASTMany(
+		entries.map(entry => entry.file),
+		entries.map(entry => entry.args),
+		// Sequential IDs are only unique within a translation unit, so units from different files could not be combined
+		{ ...manyOptions(opts), usr: true }
+	);
+
+	return asts.map((ast: clang.Node[] | ArrayBuffer, i: number) => {
+		__setEntry(opts.issueEntry ?? entries[i].file);
+		const units: xir.Unit[] = [];
+		for (const node of nativeNodes(ast)) units.push(...clang.parse(node));
+		return { file: entries[i].file, units };
+	});
+}
+
+/**
+ * Parse a C file, then parse it again whenever it changes.
+ * Clang keeps a precompiled preamble, so the headers included by the file are not parsed again on each change.
+ */
+export function watch(file: string, opts: ParseOptions, onChange: (ir: xir.Unit[]) => unknown): FSWatcher {
+	_setup(opts);
+	__setEntry(opts.issueEntry ?? file);
+
+	const index = new native.Index();
+	const unit = index.parse(file, [], {
+		preamble: true,
+		declarationsOnly: opts.declarationsOnly,
+		unsaved: opts.sources,
+	});
+
+	function update() {
+		const ir: xir.Unit[] = [];
+		for (const node of nativeNodes(unit.ast(nativeOptions(opts)))) ir.push(...clang.parse(node));
+		onChange(ir);
+	}
+
+	update();
+
+	const watcher = watchFile(file, () => {
+		try {
+			// Issues should show the new contents of the file, and in-memory sources may have been replaced
+			forgetSource(file);
+			_setup(opts);
+			unit.reparse(opts.sources);
+			update();
+		} catch (err) {
+			watcher.emit('error', err);
+		}
+	});
+	watcher.on('close', () => index.dispose());
+	return watcher;
+}
+
 export interface EmitOptions {
 	/** Type casts currently are very prone to being emitted as invalid code */
 	noCasts?: boolean;
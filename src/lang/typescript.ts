@@ -99,6 +99,23 @@ function emitName(node: { name: string }): string {
 	return node.name;
 }
 
+/**
+ * Emits a chain of binary expressions like `a + b + c`, which nest on the left.
+ * This is iterative so very long chains can't overflow the stack.
+ */
+function emitBinaryChain(u: xir.Binary): string {
+	const chain: xir.Binary[] = [u];
+	for (let left = u.left; left.length == 1 && left[0].kind == 'binary'; left = left[0].left) chain.push(left[0]);
+
+	const { left } = chain.at(-1)!;
+	let result = emitList(left, left.length == 1);
+	for (let i = chain.length - 1; i >= 0; i--) {
+		const { operator, right } = chain[i];
+		result = `${result} ${operator} ${emitList(right, right.length == 1)} `;
+	}
+	return result;
+}
+
 export function emit(u: xir.Unit): string {
 	switch (u.kind) {
 		case 'function': {
@@ -141,8 +158,9 @@ export function emit(u: xir.Unit): string {
 				return `/* __extension__ */ (() => { ${u.expression.slice(0, -1).map(emit).join(';')}; return ${emit(u.expression.at(-1)!)} })()`;
 			return `${u.operator} ${emitList(u.expression)}`;
 		case 'assignment':
-		case 'binary':
 			return `${emitList(u.left, u.left.length == 1)} ${u.operator} ${emitList(u.right, u.right.length == 1)} `;
+		case 'binary':
+			return emitBinaryChain(u);
 		case 'ternary':
 			return `${emitList(u.condition)} ? ${emitList(u.true, u.true.length <= 1)} : ${emitList(u.false, u.false.length <= 1)}`;
 		case 'postfixed': {
@@ -0,0 +1,196 @@
+#include "native.hxx"
+#include <cstring>
+#include <unordered_map>
+
+using namespace Napi;
+
+/*
+	The compact binary AST format.
+	All integers are little-endian. The layout is documented in `src/lang/clang-binary.ts`, which decodes it.
+*/
+
+const uint32_t binaryMagic = 0x54534158; // "XAST"
+const uint32_t binaryVersion = 2;
+const uint32_t binaryNone = 0xFFFFFFFF;
+
+const size_t binaryHeaderSize = 40;
+const size_t binaryNodeSize = 64;
+const size_t binaryTypeSize = 48;
+
+const uint32_t binaryConst = 1, binaryVolatile = 2, binaryRestrict = 4;
+
+class BinaryWriter
+{
+public:
+	uint32_t String(const std::string &value)
+	{
+		auto existing = stringIndices.find(value);
+		if (existing != stringIndices.end())
+			return existing->second;
+
+		// Keys in an unordered_map aren't moved when it rehashes, so they can be pointed to
+		uint32_t index = strings.size();
+		strings.push_back(&stringIndices.emplace(value, index).first->first);
+		return index;
+	}
+
+	uint32_t String(const char *value)
+	{
+		return value ? String(std::string(value)) : binaryNone;
+	}
+
+	std::vector<uint32_t> nodes;
+	std::vector<uint32_t> types;
+	std::vector<uint32_t> args;
+	std::vector<const std::string *> strings;
+
+private:
+	std::unordered_map<std::string, uint32_t> stringIndices;
+};
+
+void Put32(std::vector<uint8_t> &data, size_t offset, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		data[offset + i] = (value >> (i * 8)) & 0xFF;
+}
+
+std::vector<uint8_t> SerializeAST(const AST &ast)
+{
+	BinaryWriter writer;
+	writer.nodes.reserve(ast.nodes.size() * binaryNodeSize / 4);
+
+	// The AST's type table is used as is, since it is already deduplicated
+	for (const TypeInfo &type : ast.types)
+	{
+		bool isFunction = std::strcmp(type.structure, "function") == 0;
+		uint32_t record[binaryTypeSize / 4] = {
+			writer.String(type.qualType),
+			type.isSugared ? writer.String(type.desugaredQualType) : binaryNone,
+			writer.String(type.structure),
+			(type.isConst ? binaryConst : 0) | (type.isVolatile ? binaryVolatile : 0) | (type.isRestrict ? binaryRestrict : 0),
+			type.name.empty() ? binaryNone : writer.String(type.name),
+			writer.String(type.tag),
+			type.isAnonymous ? writer.String(type.declId) : binaryNone,
+			type.inner,
+			type.length < 0 ? binaryNone : static_cast<uint32_t>(type.length),
+			isFunction ? static_cast<uint32_t>(writer.args.size()) : binaryNone,
+			static_cast<uint32_t>(type.args.size()),
+			0,
+		};
+		writer.types.insert(writer.types.end(), std::begin(record), std::end(record));
+		writer.args.insert(writer.args.end(), type.args.begin(), type.args.end());
+	}
+
+	for (const ASTNode &node : ast.nodes)
+	{
+		uint64_t value = 0;
+		switch (node.valueKind)
+		{
+		case ValueKind::Signed:
+			value = static_cast<uint64_t>(node.signedValue);
+			break;
+		case ValueKind::Unsigned:
+			value = node.unsignedValue;
+			break;
+		case ValueKind::Float:
+			std::memcpy(&value, &node.floatValue, sizeof(double));
+			break;
+		case ValueKind::String:
+			value = writer.String(node.stringValue);
+			break;
+		case ValueKind::None:
+			break;
+		}
+
+		uint32_t record[binaryNodeSize / 4] = {
+			writer.String(node.kind),
+			writer.String(node.id),
+			writer.String(node.name),
+			writer.String(node.tagUsed),
+			static_cast<uint32_t>(node.size),
+			node.line,
+			node.col,
+			node.offset,
+			static_cast<uint32_t>(node.tokLen),
+			node.hasFile ? writer.String(node.file) : binaryNone,
+			node.type,
+			node.hasReferencedDecl ? writer.String(node.referencedName) : binaryNone,
+			node.referencedType,
+			static_cast<uint32_t>(node.valueKind),
+			static_cast<uint32_t>(value),
+			static_cast<uint32_t>(value >> 32),
+		};
+		writer.nodes.insert(writer.nodes.end(), std::begin(record), std::end(record));
+	}
+
+	size_t nodeCount = ast.nodes.size();
+	size_t typeCount = ast.types.size();
+	size_t stringCount = writer.strings.size();
+	size_t argCount = writer.args.size();
+
+	size_t nodesOffset = binaryHeaderSize;
+	size_t typesOffset = nodesOffset + nodeCount * binaryNodeSize;
+	size_t argsOffset = typesOffset + typeCount * binaryTypeSize;
+	size_t stringsOffset = argsOffset + argCount * 4;
+	size_t stringDataOffset = stringsOffset + stringCount * 8;
+
+	size_t stringDataLength = 0;
+	for (const std::string *str : writer.strings)
+		stringDataLength += str->size();
+
+	std::vector<uint8_t> data(stringDataOffset + stringDataLength);
+
+	uint32_t header[binaryHeaderSize / 4] = {
+		binaryMagic,
+		binaryVersion,
+		static_cast<uint32_t>(nodeCount),
+		static_cast<uint32_t>(typeCount),
+		static_cast<uint32_t>(stringCount),
+		static_cast<uint32_t>(nodesOffset),
+		static_cast<uint32_t>(typesOffset),
+		static_cast<uint32_t>(stringsOffset),
+		static_cast<uint32_t>(argCount),
+		static_cast<uint32_t>(argsOffset),
+	};
+	for (size_t i = 0; i < binaryHeaderSize / 4; ++i)
+		Put32(data, i * 4, header[i]);
+
+	for (size_t i = 0; i < writer.nodes.size(); ++i)
+		Put32(data, nodesOffset + i * 4, writer.nodes[i]);
+
+	for (size_t i = 0; i < writer.types.size(); ++i)
+		Put32(data, typesOffset + i * 4, writer.types[i]);
+
+	for (size_t i = 0; i < argCount; ++i)
+		Put32(data, argsOffset + i * 4, writer.args[i]);
+
+	size_t stringOffset = stringDataOffset;
+	for (size_t i = 0; i < stringCount; ++i)
+	{
+		const std::string &str = *writer.strings[i];
+		Put32(data, stringsOffset + i * 8, stringOffset);
+		Put32(data, stringsOffset + i * 8 + 4, str.size());
+		std::memcpy(data.data() + stringOffset, str.data(), str.size());
+		stringOffset += str.size();
+	}
+
+	return data;
+}
+
+ASTResult::ASTResult(AST &&collected, const ASTOptions &options) : binary(options.binary)
+{
+	if (binary)
+		data = SerializeAST(collected);
+	else
+		ast = std::move(collected);
+}
+
+Napi::Value ASTResult::ToValue(Napi::Env env) const
+{
+	if (!binary)
+		return CreateNodes(env, ast);
+
+	ArrayBuffer buffer = ArrayBuffer::New(env, data.size());
+	std::memcpy(buffer.Data(), data.data(), data.size());
+	return buffer;
+}
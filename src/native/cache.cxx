@@ -0,0 +1,212 @@
+#include "native.hxx"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+/*
+	The on-disk translation unit cache.
+	Each entry is a saved translation unit (`<key>.ast`) and a manifest (`<key>.deps`).
+	The key is a hash of the main file, clang arguments, parse flags, unsaved files, and the libclang version.
+	The manifest lists every file the translation unit includes, with a hash of its contents,
+	so an entry is only used when none of those files have changed.
+*/
+
+namespace fs = std::filesystem;
+
+const char *const cacheManifestHeader = "xcompile-tu-cache 1";
+
+/**
+ * 64-bit FNV-1a
+ */
+class Hasher
+{
+public:
+	void Add(const char *data, size_t length)
+	{
+		for (size_t i = 0; i < length; ++i)
+		{
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 0x100000001b3;
+		}
+	}
+
+	void Add(const std::string &value)
+	{
+		// The terminator is included so adjacent values can't run together
+		Add(value.c_str(), value.size() + 1);
+	}
+
+	std::string Hex() const
+	{
+		char buffer[17];
+		std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash));
+		return buffer;
+	}
+
+private:
+	uint64_t hash = 0xcbf29ce484222325;
+};
+
+/**
+ * Hashes the contents of a file, using its unsaved contents if it has them.
+ * Returns an empty string if the file can't be read.
+ */
+std::string HashFile(const std::string &path, const UnsavedFiles &unsaved)
+{
+	Hasher hasher;
+
+	for (size_t i = 0; i < unsaved.filenames.size(); ++i)
+	{
+		if (unsaved.filenames[i] != path)
+			continue;
+		hasher.Add(unsaved.contents[i]);
+		return hasher.Hex();
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return "";
+
+	char buffer[65536];
+	while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+		hasher.Add(buffer, file.gcount());
+
+	return hasher.Hex();
+}
+
+std::string CacheKey(const std::string &filename, const std::vector<std::string> &args, const ASTOptions &options)
+{
+	Hasher hasher;
+
+	CXString version = clang_getClangVersion();
+	hasher.Add(clang_getCString(version));
+	clang_disposeString(version);
+
+	std::error_code error;
+	fs::path absolute = fs::absolute(filename, error);
+	hasher.Add(error ? filename : absolute.string());
+
+	for (const std::string &arg : args)
+		hasher.Add(arg);
+
+	hasher.Add(std::to_string(GetParseFlags(options)));
+
+	for (size_t i = 0; i < options.unsaved.filenames.size(); ++i)
+	{
+		hasher.Add(options.unsaved.filenames[i]);
+		hasher.Add(options.unsaved.contents[i]);
+	}
+
+	return hasher.Hex();
+}
+
+/**
+ * Whether every file in a manifest is unchanged
+ */
+bool IsManifestFresh(const fs::path &manifestPath, const UnsavedFiles &unsaved)
+{
+	std::ifstream manifest(manifestPath);
+	if (!manifest)
+		return false;
+
+	std::string line;
+	if (!std::getline(manifest, line) || line != cacheManifestHeader)
+		return false;
+
+	while (std::getline(manifest, line))
+	{
+		size_t space = line.find(' ');
+		if (space == std::string::npos)
+			return false;
+
+		if (HashFile(line.substr(space + 1), unsaved) != line.substr(0, space))
+			return false;
+	}
+
+	return true;
+}
+
+struct InclusionsContext
+{
+	const UnsavedFiles &unsaved;
+	std::ostringstream manifest;
+	bool ok = true;
+};
+
+/**
+ * Writes the manifest for a translation unit, from the files it includes.
+ * The manifest is written to a temporary file first, so other processes never see a partial manifest.
+ */
+bool WriteManifest(CXTranslationUnit unit, const fs::path &manifestPath, const UnsavedFiles &unsaved)
+{
+	InclusionsContext ctx{unsaved};
+	ctx.manifest << cacheManifestHeader << '\n';
+
+	// The main file is included, with an empty inclusion stack
+	auto visit = [](CXFile included, CXSourceLocation *, unsigned, CXClientData data)
+	{
+		InclusionsContext *ctx = static_cast<InclusionsContext *>(data);
+
+		CXString rawName = clang_getFileName(included);
+		std::string filename = clang_getCString(rawName);
+		clang_disposeString(rawName);
+
+		std::string hash = HashFile(filename, ctx->unsaved);
+		if (hash.empty())
+			ctx->ok = false;
+
+		ctx->manifest << hash << ' ' << filename << '\n';
+	};
+	clang_getInclusions(unit, visit, &ctx);
+
+	if (!ctx.ok)
+		return false;
+
+	fs::path temp = manifestPath;
+	temp += ".tmp";
+
+	{
+		std::ofstream file(temp, std::ios::trunc);
+		file << ctx.manifest.str();
+		if (!file)
+			return false;
+	}
+
+	std::error_code error;
+	fs::rename(temp, manifestPath, error);
+	return !error;
+}
+
+CXTranslationUnit LoadTranslationUnit(CXIndex index, const std::string &filename, const std::vector<std::string> &args, const ASTOptions &options)
+{
+	if (options.cacheDir.empty())
+		return ParseTranslationUnit(index, filename, args, options.unsaved, GetParseFlags(options));
+
+	std::string key = CacheKey(filename, args, options);
+	fs::path astPath = fs::path(options.cacheDir) / (key + ".ast");
+	fs::path manifestPath = fs::path(options.cacheDir) / (key + ".deps");
+
+	if (IsManifestFresh(manifestPath, options.unsaved))
+	{
+		CXTranslationUnit unit = clang_createTranslationUnit(index, astPath.string().c_str());
+		if (unit != nullptr)
+			return unit;
+	}
+
+	CXTranslationUnit unit = ParseTranslationUnit(index, filename, args, options.unsaved, GetParseFlags(options));
+
+	// Failing to write to the cache doesn't fail the parse, the entry is just missing
+	std::error_code error;
+	fs::create_directories(options.cacheDir, error);
+	if (error)
+		return unit;
+
+	// The manifest is removed first, so a stale manifest is never paired with a new translation unit
+	fs::remove(manifestPath, error);
+	if (clang_saveTranslationUnit(unit, astPath.string().c_str(), clang_defaultSaveOptions(unit)) == CXSaveError_None)
+		WriteManifest(unit, manifestPath, options.unsaved);
+
+	return unit;
+}
@@ -0,0 +1,167 @@
+#include "native.hxx"
+#include <stdexcept>
+
+using namespace Napi;
+
+Function Cursor::Init(Napi::Env env, InstanceData *data)
+{
+	Function ctor = DefineClass(env, "Cursor", {
+												   InstanceAccessor("kind", &Cursor::GetKind, nullptr, napi_enumerable),
+												   InstanceAccessor("id", &Cursor::GetId, nullptr, napi_enumerable),
+												   InstanceAccessor("name", &Cursor::GetName, nullptr, napi_enumerable),
+												   InstanceAccessor("tagUsed", &Cursor::GetTagUsed, nullptr, napi_enumerable),
+												   InstanceAccessor("loc", &Cursor::GetLoc, nullptr, napi_enumerable),
+												   InstanceAccessor("type", &Cursor::GetType, &Cursor::SetType, napi_enumerable),
+												   InstanceAccessor("value", &Cursor::GetValue, nullptr, napi_enumerable),
+												   InstanceAccessor("referencedDecl", &Cursor::GetReferencedDecl, nullptr, napi_enumerable),
+												   InstanceAccessor("inner", &Cursor::GetInner, nullptr, napi_enumerable),
+												   InstanceMethod("toJSON", &Cursor::ToJSON),
+											   });
+	data->cursor = Persistent(ctor);
+	return ctor;
+}
+
+Array Cursor::CreateAll(Napi::Env env, Object unitObj, const std::vector<CXCursor> &cursors, std::shared_ptr<const ASTOptions> options, std::shared_ptr<NodeIds> ids)
+{
+	InstanceData *data = env.GetInstanceData<InstanceData>();
+	TranslationUnit *unitPtr = TranslationUnit::Unwrap(unitObj);
+	External<TranslationUnit> unit = External<TranslationUnit>::New(env, unitPtr);
+
+	Array result = Array::New(env, cursors.size());
+	for (size_t i = 0; i < cursors.size(); ++i)
+	{
+		Object handle = data->cursor.New({unitObj, unit});
+		Cursor *cursor = Cursor::Unwrap(handle);
+		cursor->cursor = cursors[i];
+		cursor->generation = unitPtr->Generation();
+		cursor->options = options;
+		cursor->ids = ids;
+		result.Set(i, handle);
+	}
+	return result;
+}
+
+Cursor::Cursor(const CallbackInfo &info) : ObjectWrap<Cursor>(info)
+{
+	if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsExternal())
+	{
+		throw Error::New(info.Env(), "Cursor can not be constructed directly, use TranslationUnit.cursors");
+	}
+
+	unitRef = Persistent(info[0].As<Object>());
+	unit = info[1].As<External<TranslationUnit>>().Data();
+	cursor = clang_getNullCursor();
+}
+
+void Cursor::Check(Napi::Env env) const
+{
+	// Cursors are only valid while their translation unit is, and until it is reparsed
+	unit->Get(env);
+	if (unit->Generation() != generation)
+		throw Error::New(env, "Cursor is stale, the translation unit has been reparsed");
+}
+
+const AST &Cursor::Data(Napi::Env env)
+{
+	Check(env);
+
+	if (collected)
+		return data;
+
+	try
+	{
+		data = CollectNode(cursor, *options, ids);
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw Error::New(env, e.what());
+	}
+
+	collected = true;
+	return data;
+}
+
+Value Cursor::GetKind(const CallbackInfo &info)
+{
+	return String::New(info.Env(), Data(info.Env()).nodes[0].kind);
+}
+
+Value Cursor::GetId(const CallbackInfo &info)
+{
+	return String::New(info.Env(), Data(info.Env()).nodes[0].id);
+}
+
+Value Cursor::GetName(const CallbackInfo &info)
+{
+	return String::New(info.Env(), Data(info.Env()).nodes[0].name);
+}
+
+Value Cursor::GetTagUsed(const CallbackInfo &info)
+{
+	const char *tagUsed = Data(info.Env()).nodes[0].tagUsed;
+	return tagUsed ? String::New(info.Env(), tagUsed) : info.Env().Undefined();
+}
+
+Value Cursor::GetLoc(const CallbackInfo &info)
+{
+	return NodeBuilder(info.Env()).Location(Data(info.Env()).nodes[0]);
+}
+
+Value Cursor::GetType(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+
+	// The type is kept so the same object is returned each time, and so it can be replaced
+	if (type.IsEmpty())
+	{
+		const AST &ast = Data(env);
+		type = Reference<Napi::Value>::New(Napi::Value(env, NodeBuilder(env).Type(ast, ast.nodes[0].type)), 1);
+	}
+
+	return type.Value();
+}
+
+void Cursor::SetType(const CallbackInfo &info, const Napi::Value &value)
+{
+	type = Reference<Napi::Value>::New(value, 1);
+}
+
+Value Cursor::GetValue(const CallbackInfo &info)
+{
+	return Napi::Value(info.Env(), NodeBuilder(info.Env()).Value(Data(info.Env()).nodes[0]));
+}
+
+Value Cursor::GetReferencedDecl(const CallbackInfo &info)
+{
+	const AST &ast = Data(info.Env());
+	return Napi::Value(info.Env(), NodeBuilder(info.Env()).ReferencedDecl(ast, ast.nodes[0]));
+}
+
+Value Cursor::GetInner(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+	Check(env);
+
+	if (inner.IsEmpty())
+	{
+		Array children = CreateAll(env, unitRef.Value(), CollectChildCursors(cursor, *options, false), options, ids);
+		inner = Reference<Array>::New(children, 1);
+	}
+
+	return inner.Value();
+}
+
+Value Cursor::ToJSON(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+	Check(env);
+
+	try
+	{
+		return CreateNode(env, CollectSubtree(cursor, *options, ids), 0);
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw Error::New(env, e.what());
+	}
+}
@@ -1,10 +1,42 @@
-#include <napi.h>
-#include <clang-c/Index.h>
-#include <vector>
-#include <string>
+#include "native.hxx"
+#include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <algorithm>
+#include <iterator>
+#include <fnmatch.h>
 
 using namespace Napi;
 
+/**
+ * libclang's spelling for cursor kinds without a name matching the JSON AST.
+ * Spellings are copied out of their `CXString`s once, so the returned pointers stay valid.
+ * This is shared between parsing threads, so it is guarded by a mutex.
+ */
+const char *GetCursorKindSpelling(CXCursorKind kind)
+{
+	static std::mutex mutex;
+	static std::unordered_map<int, std::string> spellings;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto existing = spellings.find(kind);
+	if (existing != spellings.end())
+		return existing->second.c_str();
+
+	CXString spelling = clang_getCursorKindSpelling(kind);
+	const char *result = spellings.emplace(kind, clang_getCString(spelling)).first->second.c_str();
+	clang_disposeString(spelling);
+	return result;
+}
+
 const char *GetCursorKindStr(CXCursorKind kind)
 {
 	switch (kind)
@@ -234,232 +266,1745 @@ const char *GetCursorKindStr(CXCursorKind kind)
 	case CXCursor_DLLImport:
 		return "DLLImport";
 	default:
-	{
-		CXString ks = clang_getCursorKindSpelling(kind);
-		const char *result = clang_getCString(ks);
-		clang_disposeString(ks);
-		return result;
-	}
+		return GetCursorKindSpelling(kind);
 	}
 }
 
-Object CreateLocation(Env env, CXCursor cursor)
+/**
+ * Sets the location of a node, returning the file it is spelled in
+ */
+CXFile SetLocation(ASTNode &node, CXCursor cursor)
 {
 	CXSourceLocation loc = clang_getCursorLocation(cursor);
 	CXFile file;
-	unsigned line, column, offset;
-	clang_getSpellingLocation(loc, &file, &line, &column, &offset);
-
-	Object locObj = Object::New(env);
-	locObj.Set("line", Number::New(env, line));
-	locObj.Set("col", Number::New(env, column));
-	locObj.Set("offset", Number::New(env, offset));
+	clang_getSpellingLocation(loc, &file, &node.line, &node.col, &node.offset);
 
 	CXSourceRange range = clang_getCursorExtent(cursor);
 	CXSourceLocation end = clang_getRangeEnd(range);
 	unsigned endOffset;
 	clang_getSpellingLocation(end, nullptr, nullptr, nullptr, &endOffset);
 
-	long long length = (long long)endOffset - (long long)offset;
-	locObj.Set("tokLen", Number::New(env, length > 0 ? length : 0));
+	long long length = (long long)endOffset - (long long)node.offset;
+	node.tokLen = length > 0 ? length : 0;
 
 	if (file)
 	{
 		CXString filename = clang_getFileName(file);
-		locObj.Set("file", String::New(env, clang_getCString(filename)));
+		node.hasFile = true;
+		node.file = clang_getCString(filename);
 		clang_disposeString(filename);
 	}
 
-	return locObj;
+	return file;
+}
+
+void SetValue(ASTNode &node, CXCursor cursor)
+{
+	CXEvalResult result = clang_Cursor_Evaluate(cursor);
+	CXEvalResultKind evalKind = clang_EvalResult_getKind(result);
+
+	switch (evalKind)
+	{
+	case CXEval_Int:
+		if (clang_EvalResult_isUnsignedInt(result))
+		{
+			node.valueKind = ValueKind::Unsigned;
+			node.unsignedValue = static_cast<uint64_t>(clang_EvalResult_getAsUnsigned(result));
+		}
+		else
+		{
+			node.valueKind = ValueKind::Signed;
+			node.signedValue = static_cast<int64_t>(clang_EvalResult_getAsLongLong(result));
+		}
+		break;
+	case CXEval_Float:
+		node.valueKind = ValueKind::Float;
+		node.floatValue = clang_EvalResult_getAsDouble(result);
+		break;
+	case CXEval_ObjCStrLiteral:
+	case CXEval_StrLiteral:
+	case CXEval_CFStr:
+	{
+		const char *str = clang_EvalResult_getAsStr(result);
+		if (str != nullptr)
+		{
+			node.valueKind = ValueKind::String;
+			node.stringValue = str;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	clang_EvalResult_dispose(result);
+}
+
+bool IsLiteralSuffix(char c, const char *suffixes)
+{
+	return c != '\0' && std::strchr(suffixes, c) != nullptr;
+}
+
+/**
+ * Parses the spelling of an integer literal, e.g. `0x1F'FFu`.
+ */
+bool ParseIntegerLiteral(const char *begin, const char *end, uint64_t &value)
+{
+	const char *p = begin;
+	unsigned base = 10;
+	bool hasDigits = false;
+	if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+	{
+		base = 16;
+		p += 2;
+	}
+	else if (end - p > 2 && p[0] == '0' && (p[1] == 'b' || p[1] == 'B'))
+	{
+		base = 2;
+		p += 2;
+	}
+	else if (p < end && p[0] == '0')
+	{
+		base = 8;
+		hasDigits = true;
+		p++;
+	}
+
+	value = 0;
+	for (; p < end; ++p)
+	{
+		// Digit separators
+		if (*p == '\'')
+			continue;
+
+		unsigned digit;
+		if (*p >= '0' && *p <= '9')
+			digit = *p - '0';
+		else if (*p >= 'a' && *p <= 'f')
+			digit = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F')
+			digit = *p - 'A' + 10;
+		else
+			break;
+
+		if (digit >= base || value > (UINT64_MAX - digit) / base)
+			return false;
+
+		value = value * base + digit;
+		hasDigits = true;
+	}
+
+	for (; p < end; ++p)
+		if (!IsLiteralSuffix(*p, "uUlLzZwWbB"))
+			return false;
+
+	return hasDigits;
+}
+
+/**
+ * Parses the spelling of a floating literal, e.g. `1.5e3f` or `0x1p-2`.
+ */
+bool ParseFloatingLiteral(const char *begin, const char *end, double &value)
+{
+	// strtod needs a terminated string without digit separators
+	char buffer[64];
+	size_t length = 0;
+	for (const char *p = begin; p < end; ++p)
+	{
+		if (*p == '\'')
+			continue;
+		if (length == sizeof(buffer) - 1)
+			return false;
+		buffer[length++] = *p;
+	}
+	buffer[length] = '\0';
+
+	char *parsed;
+	value = std::strtod(buffer, &parsed);
+	if (parsed == buffer)
+		return false;
+
+	// Suffixes like `f`, `L`, or `f16`
+	for (; *parsed; ++parsed)
+		if (!IsLiteralSuffix(*parsed, "fFlLdDbB0123456789"))
+			return false;
+
+	return true;
+}
+
+/**
+ * Parses the spelling of a narrow character literal, e.g. `'a'` or `'\n'`.
+ * Prefixed, multi-character, and non-ASCII literals are not handled.
+ */
+bool ParseCharacterLiteral(const char *begin, const char *end, int64_t &value)
+{
+	if (end - begin < 3 || begin[0] != '\'' || end[-1] != '\'')
+		return false;
+
+	const char *p = begin + 1, *last = end - 1;
+	if (*p != '\\')
+	{
+		if (last - p != 1 || static_cast<unsigned char>(*p) >= 0x80)
+			return false;
+		value = *p;
+		return true;
+	}
+
+	if (last - p != 2)
+		return false;
+
+	switch (p[1])
+	{
+	case 'n':
+		value = '\n';
+		return true;
+	case 't':
+		value = '\t';
+		return true;
+	case 'r':
+		value = '\r';
+		return true;
+	case '0':
+		value = '\0';
+		return true;
+	case 'a':
+		value = '\a';
+		return true;
+	case 'b':
+		value = '\b';
+		return true;
+	case 'f':
+		value = '\f';
+		return true;
+	case 'v':
+		value = '\v';
+		return true;
+	case '\\':
+	case '\'':
+	case '"':
+	case '?':
+		value = p[1];
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool IsUnsignedType(CXTypeKind kind)
+{
+	switch (kind)
+	{
+	case CXType_Bool:
+	case CXType_Char_U:
+	case CXType_UChar:
+	case CXType_UShort:
+	case CXType_UInt:
+	case CXType_ULong:
+	case CXType_ULongLong:
+	case CXType_UInt128:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Sets the value of a literal by parsing its spelling from the source, which is much faster than evaluating it.
+ * Returns false if the spelling isn't understood, in which case the literal should be evaluated by libclang.
+ */
+bool SetLiteralValue(ASTNode &node, CXCursor cursor, CXCursorKind kind, CXFile file, CXType type)
+{
+	if (file == nullptr || node.tokLen <= 0)
+		return false;
+
+	size_t size;
+	const char *contents = clang_getFileContents(clang_Cursor_getTranslationUnit(cursor), file, &size);
+	if (contents == nullptr || static_cast<size_t>(node.offset + node.tokLen) > size)
+		return false;
+
+	const char *begin = contents + node.offset, *end = begin + node.tokLen;
+
+	switch (kind)
+	{
+	case CXCursor_IntegerLiteral:
+	{
+		uint64_t value;
+		if (!ParseIntegerLiteral(begin, end, value))
+			return false;
+
+		if (IsUnsignedType(type.kind) || value > INT64_MAX)
+		{
+			node.valueKind = ValueKind::Unsigned;
+			node.unsignedValue = value;
+		}
+		else
+		{
+			node.valueKind = ValueKind::Signed;
+			node.signedValue = static_cast<int64_t>(value);
+		}
+		return true;
+	}
+	case CXCursor_FloatingLiteral:
+		if (!ParseFloatingLiteral(begin, end, node.floatValue))
+			return false;
+		node.valueKind = ValueKind::Float;
+		return true;
+	case CXCursor_CharacterLiteral:
+		if (!ParseCharacterLiteral(begin, end, node.signedValue))
+			return false;
+		node.valueKind = ValueKind::Signed;
+		return true;
+	case CXCursor_CXXBoolLiteralExpr:
+	{
+		std::string_view spelling(begin, end - begin);
+		if (spelling != "true" && spelling != "false")
+			return false;
+		node.valueKind = ValueKind::Unsigned;
+		node.unsignedValue = spelling == "true";
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+/**
+ * Identifies a `CXType`. Types with the same kind and data are the same type.
+ */
+struct TypeKey
+{
+	CXTypeKind kind;
+	void *data[2];
+
+	TypeKey(CXType type) : kind(type.kind), data{type.data[0], type.data[1]} {}
+
+	bool operator==(const TypeKey &other) const
+	{
+		return kind == other.kind && data[0] == other.data[0] && data[1] == other.data[1];
+	}
+};
+
+struct TypeKeyHash
+{
+	size_t operator()(const TypeKey &key) const
+	{
+		size_t hash = std::hash<void *>()(key.data[0]);
+		hash ^= std::hash<void *>()(key.data[1]) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+		return hash ^ (std::hash<int>()(key.kind) << 1);
+	}
+};
+
+/**
+ * The kind filters from the AST options for a cursor kind
+ */
+struct KindRule
+{
+	bool included = true;
+	bool excluded = false;
+	/** -1 if unlimited */
+	int maxDepth = -1;
+};
+
+struct CollectContext
+{
+	const ASTOptions &options;
+	AST ast;
+	std::string error;
+	unsigned depth = 0;
+	/** Whether declarations from a (non-main) file are kept */
+	std::unordered_map<CXFile, bool> keepFile;
+	/** Indices into the type table */
+	std::unordered_map<TypeKey, uint32_t, TypeKeyHash> typeIds;
+	/** When streaming, called with each top-level declaration. Returning false stops the walk */
+	std::function<bool(AST &&)> onRoot;
+	/** Kept across top-level declarations when streaming, so IDs stay unique */
+	std::shared_ptr<NodeIds> ids = std::make_shared<NodeIds>();
+	/** The kind filters that apply to each cursor kind, so kind names are only looked up once */
+	std::unordered_map<int, KindRule> kindRules;
+};
+
+uint32_t GetTypeId(CollectContext *ctx, CXType type);
+
+/**
+ * Formats an ID like the addresses used as IDs in Clang's JSON AST
+ */
+std::string FormatId(uint32_t id)
+{
+	char buffer[16];
+	std::snprintf(buffer, sizeof(buffer), "0x%x", id);
+	return buffer;
+}
+
+/**
+ * Gets the ID of a node.
+ * Only declarations can be referred to by other nodes or types, so other nodes are just numbered.
+ */
+std::string GetNodeId(CollectContext *ctx, CXCursor cursor)
+{
+	NodeIds &ids = *ctx->ids;
+	if (!clang_isDeclaration(clang_getCursorKind(cursor)))
+		return FormatId(ids.next++);
+
+	if (ctx->options.usr)
+	{
+		CXString usr = clang_getCursorUSR(cursor);
+		std::string result = clang_getCString(usr);
+		clang_disposeString(usr);
+		if (!result.empty())
+			return result;
+	}
+
+	auto [existing, inserted] = ids.declarations.emplace(clang_getCanonicalCursor(cursor), ids.next);
+	if (inserted)
+		ids.next++;
+	return FormatId(existing->second);
+}
+
+std::string GetTypeSpelling(CXType type)
+{
+	CXString spelling = clang_getTypeSpelling(type);
+	std::string result = clang_getCString(spelling);
+	clang_disposeString(spelling);
+	return result;
+}
+
+/**
+ * Fills in the structure of a record or enum type
+ */
+void SetTagTypeInfo(CollectContext *ctx, TypeInfo &info, CXType type, const char *structure, const char *tag)
+{
+	info.structure = structure;
+
+	CXCursor decl = clang_getTypeDeclaration(type);
+	if (clang_Cursor_isAnonymous(decl))
+	{
+		info.isAnonymous = true;
+		info.declId = GetNodeId(ctx, decl);
+		return;
+	}
+
+	// Records named by a typedef are spelled without their tag
+	info.name = GetTypeSpelling(clang_getUnqualifiedType(type));
+	size_t tagLength = std::strlen(tag);
+	if (info.name.compare(0, tagLength, tag) == 0 && info.name[tagLength] == ' ')
+	{
+		info.tag = tag;
+		info.name.erase(0, tagLength + 1);
+	}
 }
 
-Object CreateTypeInfo(Env env, CXType type)
+void SetTypeInfo(CollectContext *ctx, TypeInfo &info, CXType type)
 {
-	Object typeInfo = Object::New(env);
-	CXString typeSpelling = clang_getTypeSpelling(type);
-	typeInfo.Set("qualType", String::New(env, clang_getCString(typeSpelling)));
-	clang_disposeString(typeSpelling);
+	info.qualType = GetTypeSpelling(type);
 
 	CXType canonical = clang_getCanonicalType(type);
 	if (!clang_equalTypes(type, canonical))
 	{
-		CXString canonSpelling = clang_getTypeSpelling(canonical);
-		typeInfo.Set("desugaredQualType", String::New(env, clang_getCString(canonSpelling)));
-		clang_disposeString(canonSpelling);
+		info.isSugared = true;
+		info.desugaredQualType = GetTypeSpelling(canonical);
+	}
+
+	info.isConst = clang_isConstQualifiedType(type);
+	info.isVolatile = clang_isVolatileQualifiedType(type);
+	info.isRestrict = clang_isRestrictQualifiedType(type);
+
+	// Look through sugar that only affects the spelling
+	while (type.kind == CXType_Elaborated || type.kind == CXType_Attributed)
+		type = type.kind == CXType_Elaborated ? clang_Type_getNamedType(type) : clang_Type_getModifiedType(type);
+
+	if (type.kind >= CXType_FirstBuiltin && type.kind <= CXType_LastBuiltin)
+	{
+		info.structure = "builtin";
+		info.name = GetTypeSpelling(clang_getUnqualifiedType(type));
+		return;
+	}
+
+	switch (type.kind)
+	{
+	case CXType_Pointer:
+		info.structure = "pointer";
+		info.inner = GetTypeId(ctx, clang_getPointeeType(type));
+		return;
+	case CXType_ConstantArray:
+		info.length = clang_getArraySize(type);
+		[[fallthrough]];
+	case CXType_IncompleteArray:
+	case CXType_VariableArray:
+		info.structure = "array";
+		info.inner = GetTypeId(ctx, clang_getArrayElementType(type));
+		return;
+	case CXType_Record:
+		SetTagTypeInfo(ctx, info, type, "record", clang_getTypeDeclaration(type).kind == CXCursor_UnionDecl ? "union" : "struct");
+		return;
+	case CXType_Enum:
+		SetTagTypeInfo(ctx, info, type, "enum", "enum");
+		return;
+	case CXType_Typedef:
+	{
+		info.structure = "typedef";
+		CXString name = clang_getTypedefName(type);
+		info.name = clang_getCString(name);
+		clang_disposeString(name);
+		info.inner = GetTypeId(ctx, clang_getCanonicalType(clang_getUnqualifiedType(type)));
+		return;
+	}
+	default:
+		break;
+	}
+
+	// Function types may be wrapped in parentheses, which libclang doesn't expose
+	if (canonical.kind == CXType_FunctionProto || canonical.kind == CXType_FunctionNoProto)
+	{
+		info.structure = "function";
+		info.inner = GetTypeId(ctx, clang_getResultType(type));
+		int numArgs = clang_getNumArgTypes(type);
+		for (int i = 0; i < numArgs; ++i)
+			info.args.push_back(GetTypeId(ctx, clang_getArgType(type, i)));
 	}
-	return typeInfo;
 }
 
-struct VisitContext
+/**
+ * Gets the index of a type in the AST's type table, adding it if needed.
+ * Types are only spelled the first time they are seen.
+ */
+uint32_t GetTypeId(CollectContext *ctx, CXType type)
 {
-	Env env;
-	Array container;
-};
+	if (type.kind == CXType_Invalid)
+		return noType;
+
+	auto existing = ctx->typeIds.find(type);
+	if (existing != ctx->typeIds.end())
+		return existing->second;
+
+	// Filling in the type can add other types to the table, so it is only added once complete
+	TypeInfo info;
+	SetTypeInfo(ctx, info, type);
+
+	uint32_t id = ctx->ast.types.size();
+	ctx->ast.types.push_back(std::move(info));
+	ctx->typeIds.emplace(type, id);
+	return id;
+}
+
+bool IsKeptHeader(CollectContext *ctx, CXFile file)
+{
+	auto cached = ctx->keepFile.find(file);
+	if (cached != ctx->keepFile.end())
+		return cached->second;
+
+	CXString rawName = clang_getFileName(file);
+	const char *filename = clang_getCString(rawName);
+	bool keep = false;
+	for (const std::string &glob : ctx->options.keepHeaders)
+	{
+		if (fnmatch(glob.c_str(), filename, 0) == 0)
+		{
+			keep = true;
+			break;
+		}
+	}
+	clang_disposeString(rawName);
+
+	ctx->keepFile.emplace(file, keep);
+	return keep;
+}
+
+/**
+ * Whether a top-level cursor is skipped because of the file it is in.
+ */
+bool IsSkippedByLocation(CollectContext *ctx, CXCursor cursor)
+{
+	const ASTOptions &options = ctx->options;
+	if (!options.mainFileOnly && !options.skipSystemHeaders)
+		return false;
+
+	CXSourceLocation loc = clang_getCursorLocation(cursor);
+	if (clang_Location_isFromMainFile(loc))
+		return false;
+
+	if (!options.mainFileOnly && !clang_Location_isInSystemHeader(loc))
+		return false;
+
+	CXFile file;
+	clang_getExpansionLocation(loc, &file, nullptr, nullptr, nullptr);
+	return file == nullptr || !IsKeptHeader(ctx, file);
+}
+
+bool HasKindRules(const ASTOptions &options)
+{
+	return !options.includeKinds.empty() || !options.excludeKinds.empty() || !options.maxDepth.empty();
+}
 
-CXChildVisitResult Visit(CXCursor cursor, CXCursor parent, CXClientData client_data)
+const KindRule &GetKindRule(CollectContext *ctx, CXCursorKind kind)
 {
-	VisitContext *ctx = static_cast<VisitContext *>(client_data);
-	Env env = ctx->env;
+	auto existing = ctx->kindRules.find(kind);
+	if (existing != ctx->kindRules.end())
+		return existing->second;
+
+	const ASTOptions &options = ctx->options;
+	std::string name = GetCursorKindStr(kind);
+
+	KindRule rule;
+	rule.included = options.includeKinds.empty() || options.includeKinds.count(name);
+	rule.excluded = options.excludeKinds.count(name);
+	auto depth = options.maxDepth.find(name);
+	if (depth != options.maxDepth.end())
+		rule.maxDepth = depth->second;
+
+	return ctx->kindRules.emplace(kind, rule).first->second;
+}
 
+/**
+ * Whether a cursor and its descendants are left out of the AST
+ */
+bool IsSkipped(CollectContext *ctx, CXCursor cursor, CXCursor parent)
+{
 	if (clang_Cursor_isNull(cursor))
-		return CXChildVisit_Continue;
+		return true;
 
 	CXCursorKind kind = clang_getCursorKind(cursor);
 	if ((kind >= CXCursor_OMPParallelDirective && kind <= CXCursor_OMPStripeDirective && kind != CXCursor_SEHLeaveStmt && kind != CXCursor_BuiltinBitCastExpr) || kind == CXCursor_OMPArrayShapingExpr || kind == CXCursor_OMPIteratorExpr)
-		return CXChildVisit_Continue;
+		return true;
 	if (kind >= CXCursor_OpenACCComputeConstruct && kind <= CXCursor_OpenACCCacheConstruct)
-		return CXChildVisit_Continue;
+		return true;
 	if (clang_getCursorLanguage(cursor) == CXLanguage_ObjC)
-		return CXChildVisit_Continue;
+		return true;
+	if (ctx->depth == 0 && IsSkippedByLocation(ctx, cursor))
+		return true;
+	if (ctx->options.declarationsOnly && kind == CXCursor_CompoundStmt && clang_getCursorKind(parent) == CXCursor_FunctionDecl)
+		return true;
+
+	if (HasKindRules(ctx->options))
+	{
+		const KindRule &rule = GetKindRule(ctx, kind);
+		if (rule.excluded || (ctx->depth == 0 && !rule.included))
+			return true;
+	}
 
-	Object node = Object::New(env);
+	return false;
+}
+
+/**
+ * Fills in a node for a cursor, not including its children.
+ * On failure, this sets `ctx->error` and returns false.
+ */
+bool FillNode(CollectContext *ctx, ASTNode &node, CXCursor cursor)
+{
+	CXCursorKind kind = clang_getCursorKind(cursor);
 
-	const char *kindName = GetCursorKindStr(kind);
-	node.Set("kind", String::New(env, kindName));
+	node.kind = GetCursorKindStr(kind);
 
 	if (kind == CXCursor_StructDecl)
-		node.Set("tagUsed", String::New(env, "struct"));
+		node.tagUsed = "struct";
 	else if (kind == CXCursor_UnionDecl)
-		node.Set("tagUsed", String::New(env, "union"));
+		node.tagUsed = "union";
 	else if (kind == CXCursor_ClassDecl)
-		node.Set("tagUsed", String::New(env, "class"));
+		node.tagUsed = "class";
 
-	CXString usr = clang_getCursorUSR(cursor);
-	node.Set("id", String::New(env, clang_getCString(usr)));
-	clang_disposeString(usr);
+	node.id = GetNodeId(ctx, cursor);
 
-	CXString name = clang_getCursorSpelling(cursor);
-	std::string cursorName = clang_getCString(name);
-	node.Set("name", String::New(env, cursorName));
-	clang_disposeString(name);
+	// Newer versions of libclang spell anonymous records as "struct (unnamed at ...)"
+	if (!(node.tagUsed || kind == CXCursor_EnumDecl) || !clang_Cursor_isAnonymous(cursor))
+	{
+		CXString name = clang_getCursorSpelling(cursor);
+		node.name = clang_getCString(name);
+		clang_disposeString(name);
+	}
 
-	node.Set("loc", CreateLocation(env, cursor));
+	CXFile file = SetLocation(node, cursor);
+	CXType type = clang_getCursorType(cursor);
 
 	if (kind == CXCursor_IntegerLiteral || kind == CXCursor_FloatingLiteral || kind == CXCursor_ImaginaryLiteral || kind == CXCursor_CharacterLiteral || kind == CXCursor_CXXBoolLiteralExpr)
 	{
-		CXEvalResult result = clang_Cursor_Evaluate(cursor);
-		CXEvalResultKind evalKind = clang_EvalResult_getKind(result);
-
-		switch (evalKind)
-		{
-		case CXEval_Int:
-			if (clang_EvalResult_isUnsignedInt(result))
-				node.Set("value", BigInt::New(env, static_cast<uint64_t>(clang_EvalResult_getAsUnsigned(result))));
-			else
-				node.Set("value", BigInt::New(env, static_cast<int64_t>(clang_EvalResult_getAsLongLong(result))));
-			break;
-		case CXEval_Float:
-			node.Set("value", Number::New(env, clang_EvalResult_getAsDouble(result)));
-			break;
-		case CXEval_ObjCStrLiteral:
-		case CXEval_StrLiteral:
-		case CXEval_CFStr:
-		{
-			const char *str = clang_EvalResult_getAsStr(result);
-			if (str != nullptr)
-				node.Set("value", String::New(env, str));
-			break;
-		}
-		break;
-		}
-
-		clang_EvalResult_dispose(result);
+		if (!SetLiteralValue(node, cursor, kind, file, type))
+			SetValue(node, cursor);
 	}
 
 	if (kind == CXCursor_StringLiteral)
-		node.Set("value", String::New(env, cursorName));
-
-	CXType type = clang_getCursorType(cursor);
-	if (type.kind != CXType_Invalid)
 	{
-		node.Set("type", CreateTypeInfo(env, type));
+		node.valueKind = ValueKind::String;
+		node.stringValue = node.name;
 	}
 
+	node.type = GetTypeId(ctx, type);
+
 	if (kind == CXCursor_DeclRefExpr || kind == CXCursor_CallExpr)
 	{
 		CXCursor referenced = clang_getCursorReferenced(cursor);
 		if (clang_Cursor_isNull(referenced))
 		{
-			throw Error::New(env, "Referenced cursor is null");
+			ctx->error = "Referenced cursor is null";
+			return false;
 		}
 
-		Object refNode = Object::New(env);
+		node.hasReferencedDecl = true;
 		CXString refName = clang_getCursorSpelling(referenced);
-		refNode.Set("name", String::New(env, clang_getCString(refName)));
+		node.referencedName = clang_getCString(refName);
 		clang_disposeString(refName);
 
-		CXType refType = clang_getCursorType(referenced);
-		if (refType.kind != CXType_Invalid)
-		{
-			refNode.Set("type", CreateTypeInfo(env, refType));
-		}
-
-		node.Set("referencedDecl", refNode);
+		node.referencedType = GetTypeId(ctx, clang_getCursorType(referenced));
 	}
 
-	Array inner = Array::New(env);
-	node.Set("inner", inner);
-
-	VisitContext innerCtx = {env, inner};
-	clang_visitChildren(cursor, Visit, &innerCtx);
-
-	uint32_t len = ctx->container.Length();
-	ctx->container.Set(len, node);
-
-	return CXChildVisit_Continue;
+	return true;
 }
 
-Value GetClangAST(const CallbackInfo &args)
+/**
+ * Appends the children of a cursor that are not skipped.
+ * `ctx->depth` should be the depth of the children.
+ */
+void AppendChildCursors(CollectContext *ctx, CXCursor cursor, std::vector<CXCursor> &children)
 {
-	Env env = args.Env();
+	struct AppendContext
+	{
+		CollectContext *collect;
+		std::vector<CXCursor> &children;
+	} append{ctx, children};
 
-	if (args.Length() < 2 || !args[0].IsString() || !args[1].IsArray())
+	auto visit = [](CXCursor child, CXCursor parent, CXClientData data)
 	{
-		throw Error::New(env, "Expected (filename: string, args: string[])");
-	}
+		AppendContext *append = static_cast<AppendContext *>(data);
+		if (!IsSkipped(append->collect, child, parent))
+			append->children.push_back(child);
+		return CXChildVisit_Continue;
+	};
+	clang_visitChildren(cursor, visit, &append);
+}
 
-	std::string filename = args[0].As<String>().Utf8Value();
+/**
+ * A node whose children are being collected
+ */
+struct CollectFrame
+{
+	size_t index;
+	/** How many more levels of descendants are collected, or -1 if unlimited */
+	int depthBudget;
+	std::vector<CXCursor> children;
+	size_t next = 0;
+};
 
-	Array rawClangArgs = args[1].As<Array>();
-	const unsigned int numClangArgs = rawClangArgs.Length();
-	std::vector<std::string> clangArgsStorage;
-	std::vector<const char *> clangArgs;
+/**
+ * Collects a cursor and its descendants in pre-order.
+ * The walk uses an explicit stack rather than recursing through `clang_visitChildren`,
+ * so deeply nested expressions (e.g. long `a + b + c + ...` chains in generated code) can't overflow the C++ stack.
+ * On failure, this sets `ctx->error` and returns false.
+ */
+bool CollectTree(CollectContext *ctx, CXCursor cursor)
+{
+	std::vector<CollectFrame> stack;
+	unsigned baseDepth = ctx->depth;
+	bool hasKindRules = HasKindRules(ctx->options);
 
-	for (unsigned int i = 0; i < numClangArgs; ++i)
+	auto enter = [&](CXCursor entered)
 	{
-		clangArgsStorage.push_back(rawClangArgs.Get(i).As<String>().Utf8Value());
-		clangArgs.push_back(clangArgsStorage.back().c_str());
-	}
+		size_t index = ctx->ast.nodes.size();
+		ctx->ast.nodes.emplace_back();
+		if (!FillNode(ctx, ctx->ast.nodes.back(), entered))
+			return false;
 
-	CXIndex index = clang_createIndex(0, 1);
+		// The tightest of the parent's remaining budget and this kind's maximum depth applies
+		int budget = stack.empty() || stack.back().depthBudget < 0 ? -1 : stack.back().depthBudget - 1;
+		if (hasKindRules)
+		{
+			int maxDepth = GetKindRule(ctx, clang_getCursorKind(entered)).maxDepth;
+			if (maxDepth >= 0 && (budget < 0 || maxDepth < budget))
+				budget = maxDepth;
+		}
 
-	CXTranslationUnit unit = clang_parseTranslationUnit(
-		index,
-		filename.c_str(),
-		clangArgs.data(), numClangArgs,
-		nullptr, 0,
-		CXTranslationUnit_None);
+		ctx->depth++;
+		stack.push_back({index, budget});
+		if (budget != 0)
+			AppendChildCursors(ctx, entered, stack.back().children);
+		return true;
+	};
 
-	if (unit == nullptr)
-		throw Error::New(env, "Unable to parse translation unit");
+	bool ok = enter(cursor);
+	while (ok && !stack.empty())
+	{
+		CollectFrame &frame = stack.back();
+		if (frame.next < frame.children.size())
+		{
+			ok = enter(frame.children[frame.next++]);
+			continue;
+		}
 
-	CXCursor cursor = clang_getTranslationUnitCursor(unit);
+		ctx->ast.nodes[frame.index].size = ctx->ast.nodes.size() - frame.index;
+		stack.pop_back();
+		ctx->depth--;
+	}
 
-	Array rootNodes = Array::New(env);
-	VisitContext rootCtx = {env, rootNodes};
+	ctx->depth = baseDepth;
+	return ok;
+}
 
-	clang_visitChildren(cursor, Visit, &rootCtx);
+/**
+ * Identifies a top-level declaration across the translation units in a session
+ */
+std::string GetSessionKey(CXCursor cursor)
+{
+	CXString usr = clang_getCursorUSR(cursor);
+	std::string key = clang_getCString(usr);
+	clang_disposeString(usr);
 
-	clang_disposeTranslationUnit(unit);
-	clang_disposeIndex(index);
+	CXFile file;
+	unsigned offset;
+	clang_getExpansionLocation(clang_getCursorLocation(cursor), &file, nullptr, nullptr, &offset);
+	if (file)
+	{
+		CXString filename = clang_getFileName(file);
+		key = key + ' ' + clang_getCString(filename) + ':' + std::to_string(offset);
+		clang_disposeString(filename);
+	}
 
-	return rootNodes;
+	return key;
+}
+
+/**
+ * Adds a node in place of a top-level declaration that was already collected in the session
+ */
+void AddSessionReference(std::vector<ASTNode> &nodes, std::string key)
+{
+	ASTNode &reference = nodes.emplace_back();
+	reference.kind = "SessionReference";
+	reference.id = std::move(key);
+}
+
+/**
+ * Collects the top-level declarations in a translation unit.
+ * In a session, declarations that were already collected are replaced by references.
+ */
+void CollectRoots(CollectContext *ctx, CXTranslationUnit unit)
+{
+	std::vector<CXCursor> roots;
+	AppendChildCursors(ctx, clang_getTranslationUnitCursor(unit), roots);
+
+	SessionState *session = ctx->options.session.get();
+	bool deferred = session && ctx->options.deferSession;
+
+	for (CXCursor root : roots)
+	{
+		std::string key = session ? GetSessionKey(root) : "";
+		if (deferred)
+			ctx->ast.sessionKeys.push_back(std::move(key));
+
+		if (session && !deferred && !session->Add(key))
+			AddSessionReference(ctx->ast.nodes, std::move(key));
+		else if (!CollectTree(ctx, root))
+			return;
+
+		if (!ctx->onRoot)
+			continue;
+
+		// Each top-level declaration is handed off as soon as it is complete, along with its own type table
+		AST ast = std::move(ctx->ast);
+		ctx->ast = AST();
+		ctx->typeIds.clear();
+		if (!ctx->onRoot(std::move(ast)))
+			return;
+	}
+}
+
+void ResolveSession(AST &ast, SessionState &session)
+{
+	std::vector<ASTNode> nodes;
+	nodes.reserve(ast.nodes.size());
+
+	for (size_t i = 0, root = 0; i < ast.nodes.size(); ++root)
+	{
+		size_t size = ast.nodes[i].size;
+		if (session.Add(ast.sessionKeys[root]))
+			std::move(ast.nodes.begin() + i, ast.nodes.begin() + i + size, std::back_inserter(nodes));
+		else
+			AddSessionReference(nodes, std::move(ast.sessionKeys[root]));
+		i += size;
+	}
+
+	ast.nodes = std::move(nodes);
+	ast.sessionKeys.clear();
+}
+
+AST CollectAST(CXTranslationUnit unit, const ASTOptions &options)
+{
+	CollectContext ctx{options};
+	CollectRoots(&ctx, unit);
+
+	if (!ctx.error.empty())
+		throw std::runtime_error(ctx.error);
+
+	return std::move(ctx.ast);
+}
+
+void StreamAST(CXTranslationUnit unit, const ASTOptions &options, std::function<bool(AST &&)> onRoot)
+{
+	CollectContext ctx{options};
+	ctx.onRoot = std::move(onRoot);
+	CollectRoots(&ctx, unit);
+
+	if (!ctx.error.empty())
+		throw std::runtime_error(ctx.error);
+}
+
+AST CollectSubtree(CXCursor cursor, const ASTOptions &options, std::shared_ptr<NodeIds> ids)
+{
+	CollectContext ctx{options};
+	ctx.ids = ids;
+	// The cursor is not necessarily a top-level declaration, so it isn't filtered by location
+	ctx.depth = 1;
+	if (!IsSkipped(&ctx, cursor, clang_getNullCursor()) && !CollectTree(&ctx, cursor))
+		throw std::runtime_error(ctx.error);
+
+	return std::move(ctx.ast);
+}
+
+AST CollectNode(CXCursor cursor, const ASTOptions &options, std::shared_ptr<NodeIds> ids)
+{
+	CollectContext ctx{options};
+	ctx.ids = ids;
+	ctx.ast.nodes.emplace_back();
+	if (!FillNode(&ctx, ctx.ast.nodes.back(), cursor))
+		throw std::runtime_error(ctx.error);
+	return std::move(ctx.ast);
+}
+
+std::vector<CXCursor> CollectChildCursors(CXCursor cursor, const ASTOptions &options, bool isRoot)
+{
+	CollectContext ctx{options};
+	ctx.depth = isRoot ? 0 : 1;
+
+	std::vector<CXCursor> children;
+	AppendChildCursors(&ctx, cursor, children);
+	return children;
+}
+
+std::vector<CXUnsavedFile> UnsavedFiles::Get() const
+{
+	std::vector<CXUnsavedFile> files;
+	for (size_t i = 0; i < filenames.size(); ++i)
+		files.push_back({filenames[i].c_str(), contents[i].data(), contents[i].size()});
+	return files;
+}
+
+UnsavedFiles ReadUnsavedFiles(Object files)
+{
+	UnsavedFiles unsaved;
+	Array names = files.GetPropertyNames();
+	for (uint32_t i = 0; i < names.Length(); ++i)
+	{
+		Value name = names.Get(i);
+		Value contents = files.Get(name);
+		if (!contents.IsString())
+			throw Error::New(files.Env(), "Unsaved file contents must be strings");
+
+		unsaved.filenames.push_back(name.As<String>().Utf8Value());
+		unsaved.contents.push_back(contents.As<String>().Utf8Value());
+	}
+	return unsaved;
+}
+
+unsigned GetParseFlags(const ASTOptions &options)
+{
+	unsigned flags = CXTranslationUnit_None;
+	if (options.declarationsOnly)
+		flags |= CXTranslationUnit_SkipFunctionBodies;
+	return flags;
+}
+
+CXTranslationUnit ParseTranslationUnit(CXIndex index, const std::string &filename, const std::vector<std::string> &args, const UnsavedFiles &unsaved, unsigned flags)
+{
+	std::vector<const char *> clangArgs;
+	for (const std::string &arg : args)
+		clangArgs.push_back(arg.c_str());
+
+	std::vector<CXUnsavedFile> unsavedFiles = unsaved.Get();
+
+	CXTranslationUnit unit = clang_parseTranslationUnit(
+		index,
+		filename.c_str(),
+		clangArgs.data(), clangArgs.size(),
+		unsavedFiles.data(), unsavedFiles.size(),
+		flags);
+
+	if (unit == nullptr)
+		throw std::runtime_error("Unable to parse translation unit");
+
+	return unit;
+}
+
+/**
+ * Parses a file and collects its AST.
+ * This does not touch the JS heap, so it is safe to call from worker threads.
+ * An index must not be used by more than one thread at a time.
+ */
+AST ParseAST(CXIndex index, const std::string &filename, const std::vector<std::string> &args, const ASTOptions &options)
+{
+	CXTranslationUnit unit = LoadTranslationUnit(index, filename, args, options);
+
+	try
+	{
+		AST ast = CollectAST(unit, options);
+		clang_disposeTranslationUnit(unit);
+		return ast;
+	}
+	catch (...)
+	{
+		clang_disposeTranslationUnit(unit);
+		throw;
+	}
+}
+
+AST ParseAST(const std::string &filename, const std::vector<std::string> &args, const ASTOptions &options)
+{
+	CXIndex index = clang_createIndex(0, 1);
+
+	try
+	{
+		AST ast = ParseAST(index, filename, args, options);
+		clang_disposeIndex(index);
+		return ast;
+	}
+	catch (...)
+	{
+		clang_disposeIndex(index);
+		throw;
+	}
+}
+
+/** `Number.MAX_SAFE_INTEGER` */
+const int64_t maxSafeInteger = (int64_t(1) << 53) - 1;
+
+napi_value CreatePropertyKey(Env env, const char *name)
+{
+	napi_value key;
+	napi_status status = node_api_create_property_key_latin1(env, name, NAPI_AUTO_LENGTH, &key);
+	NAPI_THROW_IF_FAILED(env, status, nullptr);
+	return key;
+}
+
+/**
+ * The names of the properties of nodes, locations, and types.
+ * These match the order of the keys in `NodeBuilder`.
+ */
+const char *const propertyNames[] = {
+	"kind", "tagUsed", "id", "name", "loc", "line", "col", "offset", "tokLen", "file", "value", "type", "qualType",
+	"desugaredQualType", "referencedDecl", "inner", "structure", "const", "volatile", "restrict", "tag", "declId", "length", "args"};
+
+void InitPropertyKeys(Env env, InstanceData *data)
+{
+	for (const char *name : propertyNames)
+		data->propertyKeys.push_back(Reference<Napi::Value>::New(Napi::Value(env, CreatePropertyKey(env, name)), 1));
+}
+
+NodeBuilder::NodeBuilder(Napi::Env env)
+	: env(env),
+	  undefined(env.Undefined())
+{
+	// Creating property keys means hashing and internalizing them, so they are only created once per environment
+	napi_value *keys[] = {&kind, &tagUsed, &id, &name, &loc, &line, &col, &offset, &tokLen, &file, &value, &type, &qualType,
+						  &desugaredQualType, &referencedDecl, &inner, &structure, &isConst, &isVolatile, &isRestrict, &tag, &declId, &length, &args};
+	static_assert(std::size(keys) == std::size(propertyNames), "Every key must have a name");
+
+	const std::vector<Reference<Napi::Value>> &created = env.GetInstanceData<InstanceData>()->propertyKeys;
+	for (size_t i = 0; i < std::size(keys); ++i)
+		*keys[i] = created[i].Value();
+}
+
+Object NodeBuilder::Node(const AST &ast, size_t index)
+{
+	// Nodes are created from last to first, so each node's children already exist when it is created.
+	// This avoids recursing, so deeply nested expressions can't overflow the stack.
+	size_t end = index + ast.nodes[index].size;
+	std::vector<napi_value> created(end - index);
+
+	for (size_t i = end; i-- > index;)
+	{
+		const ASTNode &data = ast.nodes[i];
+
+		Array innerNodes = Array::New(env);
+		for (size_t child = i + 1, childEnd = i + data.size; child < childEnd; child += ast.nodes[child].size)
+			innerNodes.Set(innerNodes.Length(), created[child - index]);
+
+		created[i - index] = Create({
+			Property(kind, Intern(data.kind)),
+			Property(id, Intern(data.id)),
+			Property(name, Intern(data.name)),
+			Property(tagUsed, data.tagUsed ? Intern(data.tagUsed) : undefined),
+			Property(loc, Location(data)),
+			Property(type, Type(ast, data.type)),
+			Property(value, Value(data)),
+			Property(referencedDecl, ReferencedDecl(ast, data)),
+			Property(inner, innerNodes),
+		});
+	}
+
+	return Object(env, created[0]);
+}
+
+Array NodeBuilder::Nodes(const AST &ast)
+{
+	Array rootNodes = Array::New(env);
+	for (size_t i = 0; i < ast.nodes.size(); i += ast.nodes[i].size)
+		rootNodes.Set(rootNodes.Length(), Node(ast, i));
+	return rootNodes;
+}
+
+napi_value NodeBuilder::Intern(const std::string &str)
+{
+	auto existing = strings.find(str);
+	if (existing != strings.end())
+		return existing->second;
+
+	napi_value result = String::New(env, str);
+	strings.emplace(str, result);
+	return result;
+}
+
+napi_value NodeBuilder::Intern(const char *str)
+{
+	auto existing = staticStrings.find(str);
+	if (existing != staticStrings.end())
+		return existing->second;
+
+	napi_value result = String::New(env, str);
+	staticStrings.emplace(str, result);
+	return result;
+}
+
+Object NodeBuilder::Location(const ASTNode &node)
+{
+	return Create({
+		Property(line, Number::New(env, node.line)),
+		Property(col, Number::New(env, node.col)),
+		Property(offset, Number::New(env, node.offset)),
+		Property(tokLen, Number::New(env, node.tokLen)),
+		Property(file, node.hasFile ? Intern(node.file) : undefined),
+	});
+}
+
+napi_value NodeBuilder::Value(const ASTNode &node)
+{
+	switch (node.valueKind)
+	{
+	// Integers are only BigInts when they can't be represented exactly as a Number
+	case ValueKind::Signed:
+		if (node.signedValue >= -maxSafeInteger && node.signedValue <= maxSafeInteger)
+			return Number::New(env, static_cast<double>(node.signedValue));
+		return BigInt::New(env, node.signedValue);
+	case ValueKind::Unsigned:
+		if (node.unsignedValue <= static_cast<uint64_t>(maxSafeInteger))
+			return Number::New(env, static_cast<double>(node.unsignedValue));
+		return BigInt::New(env, node.unsignedValue);
+	case ValueKind::Float:
+		return Number::New(env, node.floatValue);
+	case ValueKind::String:
+		return String::New(env, node.stringValue);
+	case ValueKind::None:
+		break;
+	}
+	return undefined;
+}
+
+napi_value NodeBuilder::ReferencedDecl(const AST &ast, const ASTNode &node)
+{
+	if (!node.hasReferencedDecl)
+		return undefined;
+
+	return Create({
+		Property(name, Intern(node.referencedName)),
+		Property(type, Type(ast, node.referencedType)),
+	});
+}
+
+napi_value NodeBuilder::Type(const AST &ast, uint32_t id)
+{
+	if (id == noType)
+		return undefined;
+
+	if (typeObjects.size() < ast.types.size())
+		typeObjects.resize(ast.types.size(), nullptr);
+
+	if (typeObjects[id] != nullptr)
+		return typeObjects[id];
+
+	const TypeInfo &info = ast.types[id];
+	typeObjects[id] = Create({
+		Property(qualType, Intern(info.qualType)),
+		Property(desugaredQualType, info.isSugared ? Intern(info.desugaredQualType) : undefined),
+		Property(structure, Intern(info.structure)),
+		Property(isConst, Boolean::New(env, info.isConst)),
+		Property(isVolatile, Boolean::New(env, info.isVolatile)),
+		Property(isRestrict, Boolean::New(env, info.isRestrict)),
+		Property(name, info.name.empty() ? undefined : Intern(info.name)),
+		Property(tag, info.tag ? Intern(info.tag) : undefined),
+		Property(declId, info.isAnonymous ? Intern(info.declId) : undefined),
+		Property(inner, Type(ast, info.inner)),
+		Property(length, info.length < 0 ? undefined : Number::New(env, info.length)),
+		Property(args, TypeArgs(ast, info)),
+	});
+	return typeObjects[id];
+}
+
+napi_value NodeBuilder::TypeArgs(const AST &ast, const TypeInfo &info)
+{
+	if (std::strcmp(info.structure, "function") != 0)
+		return undefined;
+
+	Array result = Array::New(env, info.args.size());
+	for (size_t i = 0; i < info.args.size(); ++i)
+		result.Set(i, Type(ast, info.args[i]));
+	return result;
+}
+
+napi_property_descriptor NodeBuilder::Property(napi_value key, napi_value value)
+{
+	return {nullptr, key, nullptr, nullptr, nullptr, value, napi_default_jsproperty, nullptr};
+}
+
+Object NodeBuilder::Create(std::initializer_list<napi_property_descriptor> properties)
+{
+	Object object = Object::New(env);
+	napi_status status = napi_define_properties(env, object, properties.size(), properties.begin());
+	NAPI_THROW_IF_FAILED(env, status, Object());
+	return object;
+}
+
+Object CreateNode(Env env, const AST &ast, size_t index)
+{
+	return NodeBuilder(env).Node(ast, index);
+}
+
+Array CreateNodes(Env env, const AST &ast)
+{
+	return NodeBuilder(env).Nodes(ast);
+}
+
+std::vector<std::string> ReadStringArray(Array array)
+{
+	std::vector<std::string> strings;
+	for (unsigned int i = 0; i < array.Length(); ++i)
+		strings.push_back(array.Get(i).As<String>().Utf8Value());
+	return strings;
+}
+
+ASTOptions ReadASTOptions(Value value)
+{
+	ASTOptions options;
+	if (!value.IsObject())
+		return options;
+
+	Object raw = value.As<Object>();
+	options.mainFileOnly = raw.Get("mainFileOnly").ToBoolean();
+	options.skipSystemHeaders = raw.Get("skipSystemHeaders").ToBoolean();
+	options.declarationsOnly = raw.Get("declarationsOnly").ToBoolean();
+	options.binary = raw.Get("binary").ToBoolean();
+	options.lazy = raw.Get("lazy").ToBoolean();
+	options.usr = raw.Get("usr").ToBoolean();
+
+	Value cacheDir = raw.Get("cacheDir");
+	if (cacheDir.IsString())
+		options.cacheDir = cacheDir.As<String>().Utf8Value();
+
+	Value includeKinds = raw.Get("includeKinds");
+	if (includeKinds.IsArray())
+		for (std::string &kind : ReadStringArray(includeKinds.As<Array>()))
+			options.includeKinds.insert(std::move(kind));
+
+	Value excludeKinds = raw.Get("excludeKinds");
+	if (excludeKinds.IsArray())
+		for (std::string &kind : ReadStringArray(excludeKinds.As<Array>()))
+			options.excludeKinds.insert(std::move(kind));
+
+	Value maxDepth = raw.Get("maxDepth");
+	if (maxDepth.IsObject())
+	{
+		Object depths = maxDepth.As<Object>();
+		Array kinds = depths.GetPropertyNames();
+		for (uint32_t i = 0; i < kinds.Length(); ++i)
+		{
+			Value kind = kinds.Get(i);
+			Value depth = depths.Get(kind);
+			if (depth.IsNumber())
+				options.maxDepth[kind.As<String>().Utf8Value()] = depth.As<Number>().Uint32Value();
+		}
+	}
+
+	Value session = raw.Get("session");
+	if (session.IsObject() && session.As<Object>().InstanceOf(value.Env().GetInstanceData<InstanceData>()->session.Value()))
+	{
+		options.session = Session::Unwrap(session.As<Object>())->state;
+		// Declarations collected by other parses are referred to by ID, so IDs must be the same in every translation unit
+		options.usr = true;
+	}
+
+	Value unsaved = raw.Get("unsaved");
+	if (unsaved.IsObject())
+		options.unsaved = ReadUnsavedFiles(unsaved.As<Object>());
+
+	Value keepHeaders = raw.Get("keepHeaders");
+	if (keepHeaders.IsArray())
+		options.keepHeaders = ReadStringArray(keepHeaders.As<Array>());
+
+	return options;
+}
+
+void ReadParseArgs(const CallbackInfo &args, std::string &filename, std::vector<std::string> &clangArgs, ASTOptions &options)
+{
+	Env env = args.Env();
+
+	if (args.Length() < 2 || !args[0].IsString() || !args[1].IsArray())
+	{
+		throw Error::New(env, "Expected (filename: string, args: string[], options?: object)");
+	}
+
+	filename = args[0].As<String>().Utf8Value();
+	clangArgs = ReadStringArray(args[1].As<Array>());
+	if (args.Length() > 2)
+		options = ReadASTOptions(args[2]);
+}
+
+/**
+ * Parses a file into a translation unit, which is kept alive by the returned cursor handles
+ */
+Array GetLazyAST(Env env, const std::string &filename, const std::vector<std::string> &args, const ASTOptions &options)
+{
+	InstanceData *data = env.GetInstanceData<InstanceData>();
+	Object indexObj = data->index.New({});
+	CXTranslationUnit unit = LoadTranslationUnit(Index::Unwrap(indexObj)->Get(env), filename, args, options);
+	Object unitObj = data->translationUnit.New({indexObj, External<CXTranslationUnitImpl>::New(env, unit)});
+	return TranslationUnit::Unwrap(unitObj)->CreateCursors(env, options);
+}
+
+Value GetClangAST(const CallbackInfo &args)
+{
+	std::string filename;
+	std::vector<std::string> clangArgs;
+	ASTOptions options;
+	ReadParseArgs(args, filename, clangArgs, options);
+
+	try
+	{
+		if (options.lazy)
+			return GetLazyAST(args.Env(), filename, clangArgs, options);
+
+		return ASTResult(ParseAST(filename, clangArgs, options), options).ToValue(args.Env());
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw Error::New(args.Env(), e.what());
+	}
+}
+
+/**
+ * Parses and walks the AST on the libuv thread pool, only creating JS objects once done.
+ */
+class ParseWorker : public AsyncWorker
+{
+public:
+	ParseWorker(Napi::Env env, std::string filename, std::vector<std::string> args, ASTOptions options)
+		: AsyncWorker(env, "xcompile:getClangASTAsync"),
+		  deferred(Promise::Deferred::New(env)),
+		  filename(std::move(filename)),
+		  args(std::move(args)),
+		  options(std::move(options))
+	{
+	}
+
+	Promise GetPromise() const
+	{
+		return deferred.Promise();
+	}
+
+protected:
+	void Execute() override
+	{
+		result = ASTResult(ParseAST(filename, args, options), options);
+	}
+
+	void OnOK() override
+	{
+		deferred.Resolve(result.ToValue(Env()));
+	}
+
+	void OnError(const Error &e) override
+	{
+		deferred.Reject(e.Value());
+	}
+
+private:
+	Promise::Deferred deferred;
+	std::string filename;
+	std::vector<std::string> args;
+	ASTOptions options;
+	ASTResult result;
+};
+
+Value GetClangASTAsync(const CallbackInfo &args)
+{
+	std::string filename;
+	std::vector<std::string> clangArgs;
+	ASTOptions options;
+	ReadParseArgs(args, filename, clangArgs, options);
+
+	ParseWorker *worker = new ParseWorker(args.Env(), std::move(filename), std::move(clangArgs), std::move(options));
+	Promise promise = worker->GetPromise();
+	worker->Queue();
+	return promise;
+}
+
+/**
+ * Parses many files on a pool of native threads.
+ * Each thread has its own index, since an index can't be shared between concurrent parses.
+ */
+class ParseManyWorker : public AsyncWorker
+{
+public:
+	ParseManyWorker(Napi::Env env, std::vector<std::string> files, std::vector<std::vector<std::string>> args, ASTOptions options, unsigned concurrency)
+		: AsyncWorker(env, "xcompile:getClangASTMany"),
+		  deferred(Promise::Deferred::New(env)),
+		  files(std::move(files)),
+		  args(std::move(args)),
+		  options(std::move(options)),
+		  concurrency(concurrency)
+	{
+	}
+
+	Promise GetPromise() const
+	{
+		return deferred.Promise();
+	}
+
+protected:
+	void Execute() override
+	{
+		results.resize(files.size());
+		std::vector<std::string> errors(files.size());
+		std::atomic<size_t> next{0};
+
+		/*
+			With a session, declarations are only claimed once every file has been parsed, in the order of the files.
+			Otherwise which file owns a shared declaration would depend on which thread gets to it first.
+		*/
+		std::vector<AST> asts(options.session ? files.size() : 0);
+		ASTOptions parseOptions = options;
+		parseOptions.deferSession = options.session != nullptr;
+
+		auto work = [&]()
+		{
+			CXIndex index = clang_createIndex(0, 1);
+			for (size_t i = next++; i < files.size(); i = next++)
+			{
+				try
+				{
+					AST ast = ParseAST(index, files[i], args.size() == 1 ? args[0] : args[i], parseOptions);
+					if (options.session)
+						asts[i] = std::move(ast);
+					else
+						results[i] = ASTResult(std::move(ast), options);
+				}
+				catch (const std::exception &e)
+				{
+					errors[i] = e.what();
+				}
+			}
+			clang_disposeIndex(index);
+		};
+
+		// This thread is also used for parsing
+		std::vector<std::thread> threads;
+		for (unsigned i = 1; i < concurrency && i < files.size(); ++i)
+			threads.emplace_back(work);
+		work();
+		for (std::thread &thread : threads)
+			thread.join();
+
+		for (size_t i = 0; i < files.size(); ++i)
+			if (!errors[i].empty())
+				throw std::runtime_error(files[i] + ": " + errors[i]);
+
+		for (size_t i = 0; i < asts.size(); ++i)
+		{
+			ResolveSession(asts[i], *options.session);
+			results[i] = ASTResult(std::move(asts[i]), options);
+		}
+	}
+
+	void OnOK() override
+	{
+		Napi::Env env = Env();
+		Array asts = Array::New(env, results.size());
+		for (size_t i = 0; i < results.size(); ++i)
+			asts.Set(i, results[i].ToValue(env));
+		deferred.Resolve(asts);
+	}
+
+	void OnError(const Error &e) override
+	{
+		deferred.Reject(e.Value());
+	}
+
+private:
+	Promise::Deferred deferred;
+	std::vector<std::string> files;
+	/** Either the arguments for every file, or the arguments for each file */
+	std::vector<std::vector<std::string>> args;
+	ASTOptions options;
+	unsigned concurrency;
+	std::vector<ASTResult> results;
+};
+
+Value GetClangASTMany(const CallbackInfo &args)
+{
+	Env env = args.Env();
+
+	if (args.Length() < 2 || !args[0].IsArray() || !args[1].IsArray())
+	{
+		throw Error::New(env, "Expected (files: string[], args: string[] | string[][], options?: { concurrency?: number, ... })");
+	}
+
+	std::vector<std::string> files = ReadStringArray(args[0].As<Array>());
+
+	// Arguments can be given for each file, e.g. from a compilation database
+	Array rawArgs = args[1].As<Array>();
+	std::vector<std::vector<std::string>> clangArgs;
+	if (rawArgs.Length() > 0 && rawArgs.Get(0u).IsArray())
+	{
+		if (rawArgs.Length() != files.size())
+			throw Error::New(env, "Expected arguments for each file");
+
+		for (uint32_t i = 0; i < rawArgs.Length(); ++i)
+			clangArgs.push_back(ReadStringArray(rawArgs.Get(i).As<Array>()));
+	}
+	else
+		clangArgs.push_back(ReadStringArray(rawArgs));
+
+	ASTOptions options = ReadASTOptions(args[2]);
+
+	unsigned concurrency = std::thread::hardware_concurrency();
+	if (args.Length() > 2 && args[2].IsObject())
+	{
+		Value rawConcurrency = args[2].As<Object>().Get("concurrency");
+		if (rawConcurrency.IsNumber())
+			concurrency = rawConcurrency.As<Number>().Uint32Value();
+	}
+	if (concurrency == 0)
+		concurrency = 1;
+
+	ParseManyWorker *worker = new ParseManyWorker(env, std::move(files), std::move(clangArgs), std::move(options), concurrency);
+	Promise promise = worker->GetPromise();
+	worker->Queue();
+	return promise;
+}
+
+/** How many top-level declarations a stream delivers before waiting for JS to consume them */
+const unsigned streamCredits = 4;
+
+/**
+ * Flow control for a streaming parse.
+ * The parsing thread takes a credit for each declaration it delivers, and JS returns one as it consumes each,
+ * so no more than `streamCredits` declarations are ever waiting to be consumed.
+ * This is shared with the functions returned to JS, so it can outlive the stream.
+ */
+class StreamFlow
+{
+public:
+	/**
+	 * Waits for a credit, returning false if the stream was cancelled
+	 */
+	bool Acquire()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this]
+					 { return credits > 0 || cancelled; });
+		if (cancelled)
+			return false;
+		--credits;
+		return true;
+	}
+
+	void Release()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++credits;
+		changed.notify_one();
+	}
+
+	void Cancel()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		cancelled = true;
+		changed.notify_all();
+	}
+
+	bool IsCancelled()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return cancelled;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable changed;
+	unsigned credits = streamCredits;
+	bool cancelled = false;
+};
+
+/**
+ * The state of a streaming parse, shared between the parsing thread and the main thread
+ */
+struct StreamContext
+{
+	StreamContext(Napi::Env env) : deferred(Promise::Deferred::New(env)) {}
+
+	Promise::Deferred deferred;
+	std::thread thread;
+	std::string filename;
+	std::vector<std::string> args;
+	ASTOptions options;
+
+	/** An error from parsing */
+	std::string error;
+	/** Cancelled when the callback throws or JS stops the stream, which stops the walk */
+	std::shared_ptr<StreamFlow> flow = std::make_shared<StreamFlow>();
+	Reference<Value> callbackError;
+};
+
+/**
+ * Delivers a top-level declaration to the callback, on the main thread
+ */
+void DeliverRoot(StreamContext *ctx, Napi::Env env, Function callback, ASTResult *root)
+{
+	if (!ctx->flow->IsCancelled())
+	{
+		try
+		{
+			callback.Call({root->ToValue(env)});
+		}
+		catch (const Error &e)
+		{
+			ctx->flow->Cancel();
+			ctx->callbackError = Reference<Napi::Value>::New(e.Value(), 1);
+		}
+	}
+	delete root;
+}
+
+/**
+ * Parses and walks the AST on the stream's thread
+ */
+void RunStream(StreamContext *ctx, ThreadSafeFunction tsfn)
+{
+	auto onRoot = [ctx, &tsfn](AST &&root)
+	{
+		// Waits until JS has consumed enough of the declarations already delivered
+		if (!ctx->flow->Acquire())
+			return false;
+
+		ASTResult *result = new ASTResult(std::move(root), ctx->options);
+		auto deliver = [ctx](Napi::Env env, Function callback, ASTResult *root)
+		{
+			DeliverRoot(ctx, env, callback, root);
+		};
+		if (tsfn.BlockingCall(result, deliver) != napi_ok)
+		{
+			delete result;
+			return false;
+		}
+		return true;
+	};
+
+	CXIndex index = clang_createIndex(0, 1);
+	try
+	{
+		CXTranslationUnit unit = LoadTranslationUnit(index, ctx->filename, ctx->args, ctx->options);
+		try
+		{
+			StreamAST(unit, ctx->options, onRoot);
+			clang_disposeTranslationUnit(unit);
+		}
+		catch (...)
+		{
+			clang_disposeTranslationUnit(unit);
+			throw;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		ctx->error = e.what();
+	}
+	clang_disposeIndex(index);
+
+	tsfn.Release();
+}
+
+/**
+ * Parses on a separate thread, calling `callback` with each top-level declaration as soon as it is collected.
+ * Returns `{ done, pull, cancel }`:
+ * `pull()` must be called as each declaration is consumed, since the walk waits when too many have not been.
+ * `cancel()` stops the walk, and must be called if the stream is abandoned.
+ * `done` settles once every declaration has been delivered.
+ */
+Value GetClangASTStream(const CallbackInfo &args)
+{
+	Env env = args.Env();
+
+	if (args.Length() < 4 || !args[0].IsString() || !args[1].IsArray() || !args[3].IsFunction())
+	{
+		throw Error::New(env, "Expected (filename: string, args: string[], options: object | undefined, callback: (ast) => void)");
+	}
+
+	std::string filename;
+	std::vector<std::string> clangArgs;
+	ASTOptions options;
+	ReadParseArgs(args, filename, clangArgs, options);
+
+	StreamContext *ctx = new StreamContext(env);
+	ctx->filename = std::move(filename);
+	ctx->args = std::move(clangArgs);
+	ctx->options = std::move(options);
+	Promise promise = ctx->deferred.Promise();
+
+	// Called on the main thread once the parsing thread releases the function and all calls have been made
+	auto finalize = [](Napi::Env env, StreamContext *ctx)
+	{
+		ctx->thread.join();
+
+		if (!ctx->callbackError.IsEmpty())
+			ctx->deferred.Reject(ctx->callbackError.Value());
+		else if (!ctx->error.empty())
+			ctx->deferred.Reject(Error::New(env, ctx->error).Value());
+		else
+			ctx->deferred.Resolve(env.Undefined());
+
+		delete ctx;
+	};
+
+	ThreadSafeFunction tsfn = ThreadSafeFunction::New(env, args[3].As<Function>(), "xcompile:getClangASTStream", streamCredits, 1, ctx, finalize);
+
+	std::shared_ptr<StreamFlow> flow = ctx->flow;
+	ctx->thread = std::thread(RunStream, ctx, tsfn);
+
+	Object stream = Object::New(env);
+	stream.Set("done", promise);
+	stream.Set("pull", Function::New(env, [flow](const CallbackInfo &)
+									 { flow->Release(); }, "pull"));
+	stream.Set("cancel", Function::New(env, [flow](const CallbackInfo &)
+									   { flow->Cancel(); }, "cancel"));
+	return stream;
 }
 
 Object Init(Env env, Object exports)
 {
 	exports.Set(String::New(env, "getClangAST"), Function::New(env, GetClangAST));
+	exports.Set(String::New(env, "getClangASTAsync"), Function::New(env, GetClangASTAsync));
+	exports.Set(String::New(env, "getClangASTMany"), Function::New(env, GetClangASTMany));
+	exports.Set(String::New(env, "getClangASTStream"), Function::New(env, GetClangASTStream));
+
+	InstanceData *data = new InstanceData();
+	env.SetInstanceData(data);
+	InitPropertyKeys(env, data);
+	exports.Set(String::New(env, "Index"), Index::Init(env, data));
+	exports.Set(String::New(env, "TranslationUnit"), TranslationUnit::Init(env, data));
+	exports.Set(String::New(env, "Cursor"), Cursor::Init(env, data));
+	exports.Set(String::New(env, "Session"), Session::Init(env, data));
 	return exports;
 }
 
-NODE_API_MODULE(xcompile_native, Init)
\ No newline at end of file
+NODE_API_MODULE(xcompile_native, Init)
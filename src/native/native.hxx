@@ -0,0 +1,471 @@
+#pragma once
+#include <napi.h>
+#include <clang-c/Index.h>
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+const uint32_t noType = 0xFFFFFFFF;
+
+struct TypeInfo
+{
+	std::string qualType;
+	bool isSugared = false;
+	std::string desugaredQualType;
+
+	/**
+	 * The structure of the type, so it doesn't need to be parsed from its spelling.
+	 * One of builtin, pointer, array, function, record, enum, typedef, or unexposed
+	 */
+	const char *structure = "unexposed";
+	bool isConst = false, isVolatile = false, isRestrict = false;
+	/** For builtins, typedefs, records, and enums, the unqualified spelling without the tag */
+	std::string name;
+	/** For records and enums spelled with their tag, e.g. "struct" */
+	const char *tag = nullptr;
+	/** For anonymous records and enums, the ID of the declaration */
+	bool isAnonymous = false;
+	std::string declId;
+	/** The pointee, array element, function return type, or the type a typedef resolves to */
+	uint32_t inner = noType;
+	/** The length of a constant array, otherwise -1 */
+	long long length = -1;
+	/** Function argument types */
+	std::vector<uint32_t> args;
+};
+
+enum class ValueKind
+{
+	None,
+	Signed,
+	Unsigned,
+	Float,
+	String,
+};
+
+/**
+ * A node collected from libclang.
+ * This is plain native data so the AST can be walked without touching the JS heap
+ */
+struct ASTNode
+{
+	/** Kind names are static, so they are not copied for every node */
+	const char *kind = nullptr;
+	const char *tagUsed = nullptr;
+	std::string id;
+	std::string name;
+
+	unsigned line = 0, col = 0, offset = 0;
+	long long tokLen = 0;
+	bool hasFile = false;
+	std::string file;
+
+	ValueKind valueKind = ValueKind::None;
+	int64_t signedValue = 0;
+	uint64_t unsignedValue = 0;
+	double floatValue = 0;
+	std::string stringValue;
+
+	/** An index into the AST's type table, or `noType` */
+	uint32_t type = noType;
+
+	bool hasReferencedDecl = false;
+	std::string referencedName;
+	uint32_t referencedType = noType;
+
+	/** The number of nodes in this node's subtree, including itself */
+	size_t size = 1;
+};
+
+/**
+ * Nodes in pre-order, so a node's children directly follow it.
+ */
+struct AST
+{
+	std::vector<ASTNode> nodes;
+	/** Each distinct type used by the nodes, so types are only spelled once */
+	std::vector<TypeInfo> types;
+	/** With `ASTOptions::deferSession`, the session key of each top-level node */
+	std::vector<std::string> sessionKeys;
+};
+
+/**
+ * In-memory file contents, used by libclang in place of the files on disk.
+ */
+struct UnsavedFiles
+{
+	std::vector<std::string> filenames;
+	std::vector<std::string> contents;
+
+	/**
+	 * The returned structures point into this object, so it must outlive them.
+	 */
+	std::vector<CXUnsavedFile> Get() const;
+};
+
+/**
+ * Reads unsaved files from an object mapping file names to contents
+ */
+UnsavedFiles ReadUnsavedFiles(Napi::Object files);
+
+/**
+ * Parses a translation unit, throwing if libclang is unable to.
+ */
+CXTranslationUnit ParseTranslationUnit(CXIndex index, const std::string &filename, const std::vector<std::string> &args, const UnsavedFiles &unsaved, unsigned flags);
+
+/**
+ * The top-level declarations already collected in a session.
+ * Parses in a session may run on different threads, so this is guarded by a mutex.
+ */
+class SessionState
+{
+public:
+	/**
+	 * Adds a declaration, returning false if it was already added
+	 */
+	bool Add(const std::string &key);
+	size_t Size();
+	void Clear();
+
+private:
+	std::mutex mutex;
+	std::unordered_set<std::string> declarations;
+};
+
+/**
+ * Options for which parts of the AST are collected
+ */
+struct ASTOptions
+{
+	/** Skip top-level declarations that are not from the main file */
+	bool mainFileOnly = false;
+	/** Skip top-level declarations from system headers */
+	bool skipSystemHeaders = false;
+	/** Globs for headers whose declarations are kept even when they would otherwise be skipped */
+	std::vector<std::string> keepHeaders;
+	/** Skip function bodies, both when parsing and when collecting */
+	bool declarationsOnly = false;
+	/** Return the AST as an ArrayBuffer in the compact binary format, instead of as JS objects */
+	bool binary = false;
+	/** Return cursor handles, which only compute their properties and children when accessed */
+	bool lazy = false;
+	/** Use USRs as the IDs of declarations. These are stable across translation units, but expensive to compute */
+	bool usr = false;
+	/** In-memory contents for the main file or headers, used in place of the files on disk */
+	UnsavedFiles unsaved;
+	/** A directory to cache parsed translation units in. Empty if not caching */
+	std::string cacheDir;
+	/**
+	 * When set, top-level declarations that were already collected in the session are replaced with a `SessionReference` node.
+	 * This way declarations from headers included by many files are only collected and marshalled once.
+	 */
+	std::shared_ptr<SessionState> session;
+	/**
+	 * With a session, collect every top-level declaration and record its key in `AST::sessionKeys` instead of claiming it.
+	 * Which parse owns each declaration is then decided later by `ResolveSession`.
+	 */
+	bool deferSession = false;
+	/** If not empty, only top-level declarations of these kinds are collected */
+	std::unordered_set<std::string> includeKinds;
+	/** Nodes of these kinds are skipped, along with their descendants */
+	std::unordered_set<std::string> excludeKinds;
+	/** For nodes of a kind, how many levels of their descendants are collected */
+	std::unordered_map<std::string, unsigned> maxDepth;
+};
+
+struct CursorHash
+{
+	size_t operator()(const CXCursor &cursor) const { return clang_hashCursor(cursor); }
+};
+
+struct CursorEqual
+{
+	bool operator()(const CXCursor &a, const CXCursor &b) const { return clang_equalCursors(a, b); }
+};
+
+/**
+ * Node IDs are sequential, since computing USRs for every node is expensive.
+ * Each declaration is assigned one ID, shared by its redeclarations, so types can refer to it.
+ */
+struct NodeIds
+{
+	uint32_t next = 0;
+	/** Keyed by canonical cursor */
+	std::unordered_map<CXCursor, uint32_t, CursorHash, CursorEqual> declarations;
+};
+
+/**
+ * The flags to parse a translation unit with, for the given AST options
+ */
+unsigned GetParseFlags(const ASTOptions &options);
+
+ASTOptions ReadASTOptions(Napi::Value value);
+
+/**
+ * Parses a translation unit, or loads it from `options.cacheDir` if none of the files it includes have changed.
+ * On a miss, the parsed translation unit is saved to the cache.
+ */
+CXTranslationUnit LoadTranslationUnit(CXIndex index, const std::string &filename, const std::vector<std::string> &args, const ASTOptions &options);
+
+AST CollectAST(CXTranslationUnit unit, const ASTOptions &options);
+
+/**
+ * Claims the top-level declarations of an AST collected with `ASTOptions::deferSession`,
+ * replacing the ones already in the session with references
+ */
+void ResolveSession(AST &ast, SessionState &session);
+
+/**
+ * Collects a single node for `cursor`, not including its children
+ */
+AST CollectNode(CXCursor cursor, const ASTOptions &options, std::shared_ptr<NodeIds> ids);
+
+/**
+ * The children of `cursor` that are included in the AST.
+ * When `isRoot` is set, the filters for top-level declarations are applied.
+ */
+std::vector<CXCursor> CollectChildCursors(CXCursor cursor, const ASTOptions &options, bool isRoot);
+
+/**
+ * Walks the AST, passing each top-level declaration to `onRoot` once it has been collected.
+ * Each declaration has its own type table. The walk stops early if `onRoot` returns false.
+ */
+void StreamAST(CXTranslationUnit unit, const ASTOptions &options, std::function<bool(AST &&)> onRoot);
+
+/**
+ * Collects the AST for `cursor` and its descendants, with `cursor` as the first node
+ */
+AST CollectSubtree(CXCursor cursor, const ASTOptions &options, std::shared_ptr<NodeIds> ids);
+
+/**
+ * Creates JS nodes from a collected AST.
+ * Most strings (kinds, files, types, names) repeat across many nodes, so each distinct string is only created once.
+ * Property keys are created up front as internalized strings, so V8 doesn't need to look them up for every node.
+ * Values are only valid in the handle scope the builder is used in.
+ */
+class NodeBuilder
+{
+public:
+	NodeBuilder(Napi::Env env);
+
+	Napi::Object Node(const AST &ast, size_t index);
+	Napi::Array Nodes(const AST &ast);
+
+	napi_value Intern(const std::string &str);
+	/** Static strings are interned by address, which avoids hashing their contents */
+	napi_value Intern(const char *str);
+
+	Napi::Object Location(const ASTNode &node);
+	napi_value Value(const ASTNode &node);
+	napi_value ReferencedDecl(const AST &ast, const ASTNode &node);
+	/** Each type is only created once, then shared by every node that uses it */
+	napi_value Type(const AST &ast, uint32_t id);
+
+private:
+	napi_value TypeArgs(const AST &ast, const TypeInfo &info);
+
+	static napi_property_descriptor Property(napi_value key, napi_value value);
+
+	/**
+	 * Creates an object with all of its properties defined at once.
+	 * Absent properties are still defined as undefined, so objects with the same keys always have the same shape.
+	 * This keeps property accesses in `clang.ts` monomorphic.
+	 */
+	Napi::Object Create(std::initializer_list<napi_property_descriptor> properties);
+
+	Napi::Env env;
+	napi_value undefined;
+	napi_value kind, tagUsed, id, name, loc, line, col, offset, tokLen, file, value, type, qualType, desugaredQualType, referencedDecl, inner;
+	napi_value structure, isConst, isVolatile, isRestrict, tag, declId, length, args;
+	std::unordered_map<std::string, napi_value> strings;
+	std::unordered_map<const char *, napi_value> staticStrings;
+	std::vector<napi_value> typeObjects;
+};
+
+Napi::Object CreateNode(Napi::Env env, const AST &ast, size_t index);
+Napi::Array CreateNodes(Napi::Env env, const AST &ast);
+
+/**
+ * Serializes an AST to the compact binary format decoded by `src/lang/clang-binary.ts`
+ */
+std::vector<uint8_t> SerializeAST(const AST &ast);
+
+/**
+ * A collected AST, either as nodes or already serialized.
+ * Serializing is done when constructed, so it can happen off the main thread
+ */
+struct ASTResult
+{
+	bool binary = false;
+	AST ast;
+	std::vector<uint8_t> data;
+
+	ASTResult() = default;
+	ASTResult(AST &&ast, const ASTOptions &options);
+
+	Napi::Value ToValue(Napi::Env env) const;
+};
+
+std::vector<std::string> ReadStringArray(Napi::Array array);
+
+struct InstanceData
+{
+	Napi::FunctionReference index;
+	Napi::FunctionReference translationUnit;
+	Napi::FunctionReference cursor;
+	Napi::FunctionReference session;
+	/** The keys used by `NodeBuilder`, in the order of `propertyNames` */
+	std::vector<Napi::Reference<Napi::Value>> propertyKeys;
+};
+
+/**
+ * Creates the property keys used by `NodeBuilder`, once per environment
+ */
+void InitPropertyKeys(Napi::Env env, InstanceData *data);
+
+class TranslationUnit;
+
+/**
+ * A libclang index that keeps translation units alive across calls.
+ */
+class Index : public Napi::ObjectWrap<Index>
+{
+public:
+	static Napi::Function Init(Napi::Env env, InstanceData *data);
+
+	Index(const Napi::CallbackInfo &info);
+	~Index();
+
+	CXIndex Get(Napi::Env env) const;
+
+	void Register(TranslationUnit *unit);
+	void Unregister(TranslationUnit *unit);
+
+private:
+	Napi::Value Parse(const Napi::CallbackInfo &info);
+	void Dispose(const Napi::CallbackInfo &info);
+	void DisposeIndex();
+
+	CXIndex index;
+	std::unordered_set<TranslationUnit *> units;
+};
+
+/**
+ * A parsed translation unit that can be queried many times until it is disposed.
+ */
+class TranslationUnit : public Napi::ObjectWrap<TranslationUnit>
+{
+public:
+	static Napi::Function Init(Napi::Env env, InstanceData *data);
+
+	TranslationUnit(const Napi::CallbackInfo &info);
+	~TranslationUnit();
+
+	/**
+	 * Disposes of the libclang translation unit. Safe to call more than once.
+	 */
+	void DisposeUnit();
+
+	/** Throws if the translation unit has been disposed */
+	CXTranslationUnit Get(Napi::Env env) const;
+
+	/** Incremented on each reparse, which invalidates every cursor from before it */
+	uint64_t Generation() const { return generation; }
+
+	/** Creates cursor handles for the top-level declarations */
+	Napi::Array CreateCursors(Napi::Env env, const ASTOptions &options);
+
+private:
+
+	Napi::Value GetAST(const Napi::CallbackInfo &info);
+	Napi::Value Cursors(const Napi::CallbackInfo &info);
+	Napi::Value NodeAt(const Napi::CallbackInfo &info);
+	Napi::Value Diagnostics(const Napi::CallbackInfo &info);
+	Napi::Value Tokens(const Napi::CallbackInfo &info);
+	Napi::Value MemoryUsage(const Napi::CallbackInfo &info);
+	Napi::Value IsDisposed(const Napi::CallbackInfo &info);
+	void Reparse(const Napi::CallbackInfo &info);
+	void Dispose(const Napi::CallbackInfo &info);
+
+	/** Tracks the memory reported to V8 so it can be released on dispose */
+	void UpdateExternalMemory();
+
+	Napi::Env env;
+	Napi::ObjectReference indexRef;
+	Index *index = nullptr;
+	CXTranslationUnit unit = nullptr;
+	int64_t externalMemory = 0;
+	uint64_t generation = 0;
+};
+
+/**
+ * A lazy handle to a node.
+ * Properties and children are only computed when accessed, so only the parts of the AST that are used are collected.
+ * Handles keep their translation unit alive.
+ */
+class Cursor : public Napi::ObjectWrap<Cursor>
+{
+public:
+	static Napi::Function Init(Napi::Env env, InstanceData *data);
+
+	/**
+	 * Creates handles for cursors from the translation unit `unitObj`
+	 */
+	static Napi::Array CreateAll(Napi::Env env, Napi::Object unitObj, const std::vector<CXCursor> &cursors, std::shared_ptr<const ASTOptions> options, std::shared_ptr<NodeIds> ids);
+
+	Cursor(const Napi::CallbackInfo &info);
+
+private:
+	/** Throws if the translation unit has been disposed or reparsed since the handle was created */
+	void Check(Napi::Env env) const;
+
+	/** Collects the node, the first time it is needed */
+	const AST &Data(Napi::Env env);
+
+	Napi::Value GetKind(const Napi::CallbackInfo &info);
+	Napi::Value GetId(const Napi::CallbackInfo &info);
+	Napi::Value GetName(const Napi::CallbackInfo &info);
+	Napi::Value GetTagUsed(const Napi::CallbackInfo &info);
+	Napi::Value GetLoc(const Napi::CallbackInfo &info);
+	Napi::Value GetType(const Napi::CallbackInfo &info);
+	void SetType(const Napi::CallbackInfo &info, const Napi::Value &value);
+	Napi::Value GetValue(const Napi::CallbackInfo &info);
+	Napi::Value GetReferencedDecl(const Napi::CallbackInfo &info);
+	Napi::Value GetInner(const Napi::CallbackInfo &info);
+	Napi::Value ToJSON(const Napi::CallbackInfo &info);
+
+	Napi::ObjectReference unitRef;
+	TranslationUnit *unit = nullptr;
+	/** The generation of the translation unit when the handle was created */
+	uint64_t generation = 0;
+	CXCursor cursor;
+	std::shared_ptr<const ASTOptions> options;
+	/** Shared by all of the handles from a translation unit, so their IDs are consistent */
+	std::shared_ptr<NodeIds> ids;
+
+	bool collected = false;
+	AST data;
+	Napi::Reference<Napi::Value> type;
+	Napi::Reference<Napi::Array> inner;
+};
+
+/**
+ * A set of parses that share declarations, passed to them with the `session` option
+ */
+class Session : public Napi::ObjectWrap<Session>
+{
+public:
+	static Napi::Function Init(Napi::Env env, InstanceData *data);
+
+	Session(const Napi::CallbackInfo &info);
+
+	std::shared_ptr<SessionState> state;
+
+private:
+	Napi::Value GetSize(const Napi::CallbackInfo &info);
+	void Clear(const Napi::CallbackInfo &info);
+};
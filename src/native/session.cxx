@@ -0,0 +1,45 @@
+#include "native.hxx"
+
+using namespace Napi;
+
+bool SessionState::Add(const std::string &key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return declarations.insert(key).second;
+}
+
+size_t SessionState::Size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return declarations.size();
+}
+
+void SessionState::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	declarations.clear();
+}
+
+Function Session::Init(Napi::Env env, InstanceData *data)
+{
+	Function ctor = DefineClass(env, "Session", {
+													InstanceAccessor("size", &Session::GetSize, nullptr),
+													InstanceMethod("clear", &Session::Clear),
+												});
+	data->session = Persistent(ctor);
+	return ctor;
+}
+
+Session::Session(const CallbackInfo &info) : ObjectWrap<Session>(info), state(std::make_shared<SessionState>())
+{
+}
+
+Value Session::GetSize(const CallbackInfo &info)
+{
+	return Number::New(info.Env(), state->Size());
+}
+
+void Session::Clear(const CallbackInfo &info)
+{
+	state->Clear();
+}
@@ -0,0 +1,411 @@
+#include "native.hxx"
+#include <stdexcept>
+
+using namespace Napi;
+
+Function Index::Init(Napi::Env env, InstanceData *data)
+{
+	Function ctor = DefineClass(env, "Index", {
+												  InstanceMethod("parse", &Index::Parse),
+												  InstanceMethod("dispose", &Index::Dispose),
+											  });
+	data->index = Persistent(ctor);
+	return ctor;
+}
+
+Index::Index(const CallbackInfo &info) : ObjectWrap<Index>(info)
+{
+	index = clang_createIndex(0, 1);
+}
+
+Index::~Index()
+{
+	DisposeIndex();
+}
+
+CXIndex Index::Get(Napi::Env env) const
+{
+	if (index == nullptr)
+		throw Error::New(env, "Index has been disposed");
+	return index;
+}
+
+void Index::Register(TranslationUnit *unit)
+{
+	units.insert(unit);
+}
+
+void Index::Unregister(TranslationUnit *unit)
+{
+	units.erase(unit);
+}
+
+Value Index::Parse(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+
+	if (info.Length() < 2 || !info[0].IsString() || !info[1].IsArray())
+	{
+		throw Error::New(env, "Expected (filename: string, args: string[], options?: { unsaved?: Record<string, string>, preamble?: boolean, declarationsOnly?: boolean })");
+	}
+
+	std::string filename = info[0].As<String>().Utf8Value();
+	std::vector<std::string> clangArgs = ReadStringArray(info[1].As<Array>());
+
+	UnsavedFiles unsaved;
+	unsigned flags = CXTranslationUnit_None;
+	if (info.Length() > 2 && info[2].IsObject())
+	{
+		Object options = info[2].As<Object>();
+
+		Napi::Value rawUnsaved = options.Get("unsaved");
+		if (rawUnsaved.IsObject())
+			unsaved = ReadUnsavedFiles(rawUnsaved.As<Object>());
+
+		// The preamble (the includes at the top of the main file) is precompiled, so reparsing only redoes the rest
+		if (options.Get("preamble").ToBoolean())
+			flags |= CXTranslationUnit_PrecompiledPreamble | CXTranslationUnit_CreatePreambleOnFirstParse;
+
+		if (options.Get("declarationsOnly").ToBoolean())
+			flags |= CXTranslationUnit_SkipFunctionBodies;
+	}
+
+	CXTranslationUnit unit;
+	try
+	{
+		unit = ParseTranslationUnit(Get(env), filename, clangArgs, unsaved, flags);
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw Error::New(env, e.what());
+	}
+
+	InstanceData *data = env.GetInstanceData<InstanceData>();
+	return data->translationUnit.New({info.This(), External<CXTranslationUnitImpl>::New(env, unit)});
+}
+
+void Index::Dispose(const CallbackInfo &info)
+{
+	DisposeIndex();
+}
+
+void Index::DisposeIndex()
+{
+	if (index == nullptr)
+		return;
+
+	// libclang requires translation units to be disposed before their index
+	std::unordered_set<TranslationUnit *> remaining;
+	remaining.swap(units);
+	for (TranslationUnit *unit : remaining)
+		unit->DisposeUnit();
+
+	clang_disposeIndex(index);
+	index = nullptr;
+}
+
+Function TranslationUnit::Init(Napi::Env env, InstanceData *data)
+{
+	Function ctor = DefineClass(env, "TranslationUnit", {
+															InstanceMethod("ast", &TranslationUnit::GetAST),
+															InstanceMethod("cursors", &TranslationUnit::Cursors),
+															InstanceMethod("nodeAt", &TranslationUnit::NodeAt),
+															InstanceMethod("diagnostics", &TranslationUnit::Diagnostics),
+															InstanceMethod("tokens", &TranslationUnit::Tokens),
+															InstanceMethod("memoryUsage", &TranslationUnit::MemoryUsage),
+															InstanceMethod("reparse", &TranslationUnit::Reparse),
+															InstanceAccessor("disposed", &TranslationUnit::IsDisposed, nullptr),
+															InstanceMethod("dispose", &TranslationUnit::Dispose),
+														});
+	data->translationUnit = Persistent(ctor);
+	return ctor;
+}
+
+TranslationUnit::TranslationUnit(const CallbackInfo &info) : ObjectWrap<TranslationUnit>(info), env(info.Env())
+{
+	if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsExternal())
+	{
+		throw Error::New(env, "TranslationUnit can not be constructed directly, use Index.parse");
+	}
+
+	Object indexObj = info[0].As<Object>();
+	index = Index::Unwrap(indexObj);
+	indexRef = Persistent(indexObj);
+	unit = info[1].As<External<CXTranslationUnitImpl>>().Data();
+
+	index->Register(this);
+	UpdateExternalMemory();
+}
+
+TranslationUnit::~TranslationUnit()
+{
+	DisposeUnit();
+}
+
+void TranslationUnit::DisposeUnit()
+{
+	if (unit == nullptr)
+		return;
+
+	clang_disposeTranslationUnit(unit);
+	unit = nullptr;
+	UpdateExternalMemory();
+
+	index->Unregister(this);
+	index = nullptr;
+	indexRef.Reset();
+}
+
+void TranslationUnit::UpdateExternalMemory()
+{
+	int64_t total = 0;
+	if (unit != nullptr)
+	{
+		CXTUResourceUsage usage = clang_getCXTUResourceUsage(unit);
+		for (unsigned i = 0; i < usage.numEntries; ++i)
+			total += usage.entries[i].amount;
+		clang_disposeCXTUResourceUsage(usage);
+	}
+
+	MemoryManagement::AdjustExternalMemory(env, total - externalMemory);
+	externalMemory = total;
+}
+
+CXTranslationUnit TranslationUnit::Get(Napi::Env env) const
+{
+	if (unit == nullptr)
+		throw Error::New(env, "TranslationUnit has been disposed");
+	return unit;
+}
+
+Value TranslationUnit::GetAST(const CallbackInfo &info)
+{
+	CXTranslationUnit unit = Get(info.Env());
+	ASTOptions options = ReadASTOptions(info[0]);
+
+	try
+	{
+		return ASTResult(CollectAST(unit, options), options).ToValue(info.Env());
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw Error::New(info.Env(), e.what());
+	}
+}
+
+Array TranslationUnit::CreateCursors(Napi::Env env, const ASTOptions &options)
+{
+	CXCursor root = clang_getTranslationUnitCursor(Get(env));
+	return Cursor::CreateAll(env, Value(), CollectChildCursors(root, options, true), std::make_shared<const ASTOptions>(options), std::make_shared<NodeIds>());
+}
+
+Value TranslationUnit::Cursors(const CallbackInfo &info)
+{
+	return CreateCursors(info.Env(), ReadASTOptions(info[0]));
+}
+
+Value TranslationUnit::NodeAt(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+	CXTranslationUnit unit = Get(env);
+
+	if (info.Length() < 1 || !info[0].IsNumber())
+	{
+		throw Error::New(env, "Expected (offset: number, options?: object)");
+	}
+
+	CXString spelling = clang_getTranslationUnitSpelling(unit);
+	CXFile file = clang_getFile(unit, clang_getCString(spelling));
+	clang_disposeString(spelling);
+	if (file == nullptr)
+		return env.Undefined();
+
+	CXSourceLocation loc = clang_getLocationForOffset(unit, file, info[0].As<Number>().Uint32Value());
+	CXCursor cursor = clang_getCursor(unit, loc);
+	if (clang_Cursor_isNull(cursor))
+		return env.Undefined();
+
+	try
+	{
+		AST ast = CollectSubtree(cursor, ReadASTOptions(info[1]), std::make_shared<NodeIds>());
+		if (ast.nodes.empty())
+			return env.Undefined();
+		return CreateNode(env, ast, 0);
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw Error::New(env, e.what());
+	}
+}
+
+Object CreateSourceLocation(Napi::Env env, CXSourceLocation loc)
+{
+	CXFile file;
+	unsigned line, column, offset;
+	clang_getSpellingLocation(loc, &file, &line, &column, &offset);
+
+	Object locObj = Object::New(env);
+	locObj.Set("line", Number::New(env, line));
+	locObj.Set("col", Number::New(env, column));
+	locObj.Set("offset", Number::New(env, offset));
+
+	if (file)
+	{
+		CXString filename = clang_getFileName(file);
+		locObj.Set("file", String::New(env, clang_getCString(filename)));
+		clang_disposeString(filename);
+	}
+
+	return locObj;
+}
+
+const char *GetSeverityStr(CXDiagnosticSeverity severity)
+{
+	switch (severity)
+	{
+	case CXDiagnostic_Ignored:
+		return "ignored";
+	case CXDiagnostic_Note:
+		return "note";
+	case CXDiagnostic_Warning:
+		return "warning";
+	case CXDiagnostic_Error:
+		return "error";
+	case CXDiagnostic_Fatal:
+		return "fatal";
+	}
+	return "unknown";
+}
+
+Value TranslationUnit::Diagnostics(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+	CXTranslationUnit unit = Get(env);
+
+	unsigned count = clang_getNumDiagnostics(unit);
+	Array diagnostics = Array::New(env, count);
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		CXDiagnostic diagnostic = clang_getDiagnostic(unit, i);
+		Object diag = Object::New(env);
+
+		diag.Set("severity", String::New(env, GetSeverityStr(clang_getDiagnosticSeverity(diagnostic))));
+
+		CXString message = clang_getDiagnosticSpelling(diagnostic);
+		diag.Set("message", String::New(env, clang_getCString(message)));
+		clang_disposeString(message);
+
+		CXString option = clang_getDiagnosticOption(diagnostic, nullptr);
+		diag.Set("option", String::New(env, clang_getCString(option)));
+		clang_disposeString(option);
+
+		diag.Set("loc", CreateSourceLocation(env, clang_getDiagnosticLocation(diagnostic)));
+
+		clang_disposeDiagnostic(diagnostic);
+		diagnostics.Set(i, diag);
+	}
+
+	return diagnostics;
+}
+
+const char *GetTokenKindStr(CXTokenKind kind)
+{
+	switch (kind)
+	{
+	case CXToken_Punctuation:
+		return "punctuation";
+	case CXToken_Keyword:
+		return "keyword";
+	case CXToken_Identifier:
+		return "identifier";
+	case CXToken_Literal:
+		return "literal";
+	case CXToken_Comment:
+		return "comment";
+	}
+	return "unknown";
+}
+
+Value TranslationUnit::Tokens(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+	CXTranslationUnit unit = Get(env);
+
+	CXSourceRange range = clang_getCursorExtent(clang_getTranslationUnitCursor(unit));
+	CXToken *tokens;
+	unsigned count;
+	clang_tokenize(unit, range, &tokens, &count);
+
+	Array result = Array::New(env, count);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		Object token = Object::New(env);
+		token.Set("kind", String::New(env, GetTokenKindStr(clang_getTokenKind(tokens[i]))));
+
+		CXString spelling = clang_getTokenSpelling(unit, tokens[i]);
+		token.Set("spelling", String::New(env, clang_getCString(spelling)));
+		clang_disposeString(spelling);
+
+		token.Set("loc", CreateSourceLocation(env, clang_getRangeStart(clang_getTokenExtent(unit, tokens[i]))));
+		result.Set(i, token);
+	}
+
+	clang_disposeTokens(unit, tokens, count);
+	return result;
+}
+
+Value TranslationUnit::MemoryUsage(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+	CXTranslationUnit unit = Get(env);
+
+	CXTUResourceUsage usage = clang_getCXTUResourceUsage(unit);
+	Object entries = Object::New(env);
+	double total = 0;
+	for (unsigned i = 0; i < usage.numEntries; ++i)
+	{
+		entries.Set(clang_getTUResourceUsageName(usage.entries[i].kind), Number::New(env, usage.entries[i].amount));
+		total += usage.entries[i].amount;
+	}
+	clang_disposeCXTUResourceUsage(usage);
+
+	Object result = Object::New(env);
+	result.Set("total", Number::New(env, total));
+	result.Set("entries", entries);
+	return result;
+}
+
+Value TranslationUnit::IsDisposed(const CallbackInfo &info)
+{
+	return Boolean::New(info.Env(), unit == nullptr);
+}
+
+void TranslationUnit::Reparse(const CallbackInfo &info)
+{
+	Napi::Env env = info.Env();
+	CXTranslationUnit unit = Get(env);
+
+	UnsavedFiles unsaved;
+	if (info.Length() > 0 && info[0].IsObject())
+		unsaved = ReadUnsavedFiles(info[0].As<Object>());
+
+	// Reparsing invalidates existing cursors, even when it fails
+	++generation;
+
+	std::vector<CXUnsavedFile> unsavedFiles = unsaved.Get();
+	int error = clang_reparseTranslationUnit(unit, unsavedFiles.size(), unsavedFiles.data(), clang_defaultReparseOptions(unit));
+	if (error)
+	{
+		// The translation unit is no longer valid
+		DisposeUnit();
+		throw Error::New(env, "Unable to reparse translation unit");
+	}
+
+	UpdateExternalMemory();
+}
+
+void TranslationUnit::Dispose(const CallbackInfo &info)
+{
+	DisposeUnit();
+}